@@ -1,17 +1,24 @@
 #include "MemoryStore.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <stdexcept>
 
 #include "Utilities.h"
+#include "checkpoint.h"
 
 MemoryStore::MemoryStore(uint64_t startAddr, uint64_t numEntries)
-    : startAddr(startAddr) {
-    // fill memory array with 0s
-    memArr.resize(numEntries);
-    std::fill(memArr.begin(), memArr.end(), 0);
+    : startAddr(startAddr), size(numEntries) {
+    // Pages are zero-filled as they are first written
 
     // If we can't initialise memory appropriately, don't return a
     // MemoryStore at all.
@@ -19,10 +26,8 @@ MemoryStore::MemoryStore(uint64_t startAddr, uint64_t numEntries)
 }
 
 MemoryStore::MemoryStore(uint64_t startAddr, uint64_t numEntries, const char *fileName)
-    : startAddr(startAddr) {
-    // fill memory array with 0s
-    memArr.resize(numEntries);
-    std::fill(memArr.begin(), memArr.end(), 0);
+    : startAddr(startAddr), size(numEntries) {
+    // Pages are zero-filled as they are first written
 
     // If we can't initialise memory appropriately, don't return a
     // MemoryStore at all.
@@ -31,11 +36,65 @@ MemoryStore::MemoryStore(uint64_t startAddr, uint64_t numEntries, const char *fi
     loadFromFile(fileName);
 }
 
-int prepareMemory(MemoryStore *mem) {
-    std::ifstream initMem;
-    initMem.open("init_mem_image", std::ios::in);
+// Share all pages with other; neither side copies a page until it writes to it
+MemoryStore::MemoryStore(const MemoryStore &other)
+    : startAddr(other.startAddr), size(other.size), pages(other.pages) {}
+
+// Return a copy of this memory that shares its pages copy-on-write, so that a
+// loaded image can be forked in time proportional to the pages touched. The
+// write watch is not copied.
+MemoryStore *MemoryStore::clone() {
+    // Our pages are shared from now on, so the cached one must not be
+    // written through anymore
+    lastPageWritable = false;
+    return new MemoryStore(*this);
+}
 
-    // For tests that don't require such an initial memory image, nothing is done.
+// Pages that were written but hold only zeros are left out, they read the
+// same as pages that were never written. Pages go in address order, so the
+// same memory always gives the same file.
+void MemoryStore::saveCheckpoint(CheckpointWriter &writer) const {
+    static const MemPage zeroPage = {};
+    std::vector<uint64_t> pageNums;
+    for (const auto &entry : pages) {
+        if (std::memcmp(entry.second->bytes, zeroPage.bytes, MEM_PAGE_SIZE) != 0) {
+            pageNums.push_back(entry.first);
+        }
+    }
+    std::sort(pageNums.begin(), pageNums.end());
+
+    writer.put<uint32_t>(CHECKPOINT_TAG_MEMORY);
+    writer.put(startAddr);
+    writer.put(size);
+    writer.put<uint64_t>(pageNums.size());
+    for (uint64_t pageNum : pageNums) {
+        writer.put(pageNum);
+        writer.putBytes(pages.at(pageNum)->bytes, MEM_PAGE_SIZE);
+    }
+}
+
+void MemoryStore::restoreCheckpoint(CheckpointReader &reader) {
+    reader.expectTag(CHECKPOINT_TAG_MEMORY);
+    startAddr = reader.get<uint64_t>();
+    size = reader.get<uint64_t>();
+    pages.clear();
+    lastPageNum = UINT64_MAX;
+    lastPage = nullptr;
+    lastPageWritable = false;
+    for (uint64_t numPages = reader.get<uint64_t>(); numPages > 0; numPages--) {
+        uint64_t pageNum = reader.get<uint64_t>();
+        if (size == 0 || pageNum > (size - 1) >> MEM_PAGE_SHIFT) {
+            throw std::invalid_argument("Checkpoint memory page " + std::to_string(pageNum) +
+                                        " is past the end of memory");
+        }
+        std::shared_ptr<MemPage> page = std::make_shared<MemPage>();
+        reader.getBytes(page->bytes, MEM_PAGE_SIZE);
+        pages[pageNum] = page;
+    }
+}
+
+// Load a text image: whitespace separated hex address/word pairs
+static int loadTextImage(MemoryStore *mem, std::istream &initMem) {
     while (initMem && mem) {
         uint32_t curVal = 0;
         uint32_t addr = 0;
@@ -54,73 +113,267 @@ int prepareMemory(MemoryStore *mem) {
     return 0;
 }
 
+// Load a binary image, one bulk copy per segment
+static int loadBinaryImage(MemoryStore *mem, std::istream &initMem, const MemImageHeader &header) {
+    if (header.version != MEM_IMAGE_VERSION) {
+        std::cerr << LOG_ERROR << "Unsupported memory image version " << header.version << std::endl;
+        return -EINVAL;
+    }
+
+    std::vector<uint8_t> buf;
+    for (uint64_t i = 0; i < header.numSegments; i++) {
+        MemImageSegment segment;
+        if (!initMem.read(reinterpret_cast<char *>(&segment), sizeof(segment))) {
+            std::cerr << LOG_ERROR << "Truncated memory image segment " << i << std::endl;
+            return -EINVAL;
+        }
+        if (segment.length > mem->getSize()) {
+            std::cerr << LOG_ERROR << "Memory image segment " << i << " does not fit in memory"
+                      << std::endl;
+            return -EINVAL;
+        }
+
+        buf.resize(segment.length);
+        if (!initMem.read(reinterpret_cast<char *>(buf.data()), segment.length)) {
+            std::cerr << LOG_ERROR << "Truncated memory image segment " << i << std::endl;
+            return -EINVAL;
+        }
+
+        if (mem->writeBlock(segment.address, buf.data(), segment.length)) {
+            std::cout << LOG_ERROR << "Could not set initial memory value!" << std::endl;
+            return -EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+int prepareMemory(MemoryStore *mem, const char *fileName) {
+    std::ifstream initMem;
+    initMem.open(fileName, std::ios::in | std::ios::binary);
+
+    // For tests that don't require such an initial memory image, nothing is done.
+    if (!initMem || !mem) {
+        return 0;
+    }
+
+    // Binary images start with a header, anything else is read as text
+    MemImageHeader header;
+    if (initMem.read(reinterpret_cast<char *>(&header), sizeof(header)) &&
+        header.magic == MEM_IMAGE_MAGIC) {
+        return loadBinaryImage(mem, initMem, header);
+    }
+
+    initMem.clear();
+    initMem.seekg(0, std::ios::beg);
+    return loadTextImage(mem, initMem);
+}
+
+// Return the page if it has been allocated, nullptr otherwise. The page may
+// be shared with a clone, so it must not be written through.
+uint8_t *MemoryStore::findPage(uint64_t pageNum) {
+    if (pageNum == lastPageNum) {
+        return lastPage;
+    }
+    auto it = pages.find(pageNum);
+    if (it == pages.end()) {
+        return nullptr;
+    }
+    cachePage(pageNum, it->second->bytes, it->second.use_count() == 1);
+    return it->second->bytes;
+}
+
+// Return the page for writing, allocating a zero-filled one on first use and
+// copying it first if it is shared with a clone
+uint8_t *MemoryStore::touchPage(uint64_t pageNum) {
+    if (pageNum == lastPageNum && lastPageWritable) {
+        return lastPage;
+    }
+    std::shared_ptr<MemPage> &entry = pages[pageNum];
+    if (!entry) {
+        entry = std::make_shared<MemPage>();
+    } else if (entry.use_count() > 1) {
+        entry = std::make_shared<MemPage>(*entry);
+    }
+    cachePage(pageNum, entry->bytes, true);
+    return entry->bytes;
+}
+
+// Only pages that lie entirely inside memory are cached, so that a hit in the
+// inline fast paths needs no range check beyond the page offset
+void MemoryStore::cachePage(uint64_t pageNum, uint8_t *page, bool writable) {
+    if (pageNum < (size >> MEM_PAGE_SHIFT)) {
+        lastPageNum = pageNum;
+        lastPage = page;
+        lastPageWritable = writable;
+    }
+}
+
+uint8_t MemoryStore::readByte(uint64_t relativeAddr) {
+    uint8_t *page = findPage(relativeAddr >> MEM_PAGE_SHIFT);
+    return page ? page[relativeAddr & MEM_PAGE_MASK] : 0;
+}
+
 int MemoryStore::getOrSetValue(bool get, uint64_t address, uint64_t &value, MemEntrySize size) {
     uint64_t byteSize = static_cast<uint64_t>(size);
 
-    switch (size) {
-        case BYTE_SIZE:
-        case HALF_SIZE:
-        case WORD_SIZE:
-        case DOUBLE_SIZE:
-            break;
-        default:
-            std::cerr << LOG_ERROR << "Invalid size passed, cannot read/write memory" << std::endl;
-            return -EINVAL;
+    // Sizes are 1, 2, 4 or 8 bytes
+    if (byteSize == 0 || byteSize > DOUBLE_SIZE || (byteSize & (byteSize - 1)) != 0) {
+        std::cerr << LOG_ERROR << "Invalid size passed, cannot read/write memory" << std::endl;
+        return -EINVAL;
     }
 
+    // One range check for the whole access
     uint64_t relativeAddr = address - startAddr;
-    try {
+    if (address < startAddr || relativeAddr > this->size || this->size - relativeAddr < byteSize) {
+        if (get) {
+            value = 0;
+        }
+        std::cerr << LOG_ERROR << "Access violation at address 0x" << std::hex << address << std::endl;
+        return -EINVAL;
+    }
+
+    uint64_t offset = relativeAddr & MEM_PAGE_MASK;
+    if (offset + byteSize > MEM_PAGE_SIZE) {
+        // Straddles two pages, so go a byte at a time
         if (get) {
             value = 0;
             for (uint64_t i = 0; i < byteSize; ++i) {
-                value |= ((uint64_t)memArr.at(relativeAddr + i) << (i * 8));
+                value |= ((uint64_t)readByte(relativeAddr + i) << (i * 8));
             }
         } else {
             for (uint64_t i = 0; i < byteSize; ++i) {
-                memArr.at(relativeAddr + i) = (value >> (i * 8)) & 0xFF;
+                uint64_t byteAddr = relativeAddr + i;
+                touchPage(byteAddr >> MEM_PAGE_SHIFT)[byteAddr & MEM_PAGE_MASK] = (value >> (i * 8)) & 0xFF;
             }
         }
-    } catch (const std::out_of_range &e) {
-        std::cerr << LOG_ERROR << "Access violation at address 0x" << std::hex << address << std::endl;
-        return -EINVAL;
+        return 0;
+    }
+
+    uint64_t pageNum = relativeAddr >> MEM_PAGE_SHIFT;
+    uint8_t *page = get ? findPage(pageNum) : touchPage(pageNum);
+    if (!page) {
+        // Untouched memory reads as zero
+        value = 0;
+        return 0;
+    }
+
+    uint8_t *bytes = page + offset;
+    switch (size) {
+        case BYTE_SIZE:
+            accessBytes<BYTE_SIZE>(get, bytes, value);
+            break;
+        case HALF_SIZE:
+            accessBytes<HALF_SIZE>(get, bytes, value);
+            break;
+        case WORD_SIZE:
+            accessBytes<WORD_SIZE>(get, bytes, value);
+            break;
+        case DOUBLE_SIZE:
+            accessBytes<DOUBLE_SIZE>(get, bytes, value);
+            break;
     }
 
     return 0;
 }
 
-int MemoryStore::getMemValue(uint64_t address, uint64_t &value, MemEntrySize size) {
+int MemoryStore::getSlow(uint64_t address, uint64_t &value, MemEntrySize size) {
     return getOrSetValue(true, address, value, size);
 }
 
-int MemoryStore::setMemValue(uint64_t address, uint64_t value, MemEntrySize size) {
-    return getOrSetValue(false, address, value, size);
+int MemoryStore::setSlow(uint64_t address, uint64_t value, MemEntrySize size) {
+    int ret = getOrSetValue(false, address, value, size);
+    if (address < watchEnd && address + size > watchStart && writeWatcher) {
+        writeWatcher(watchOwner, address, size);
+    }
+    return ret;
+}
+
+// Report writes into [start, end) to watcher, replacing any earlier watch
+void MemoryStore::setWriteWatch(uint64_t start, uint64_t end, WriteWatcher watcher, void *owner) {
+    watchStart = start;
+    watchEnd = end;
+    writeWatcher = watcher;
+    watchOwner = owner;
+}
+
+// Copy size bytes from data into memory starting at address
+int MemoryStore::writeBlock(uint64_t address, const uint8_t *data, uint64_t size) {
+    uint64_t relativeAddr = address - startAddr;
+    if (address < startAddr || relativeAddr > this->size || this->size - relativeAddr < size) {
+        std::cerr << LOG_ERROR << "Access violation at address 0x" << std::hex << address << std::endl;
+        return -EINVAL;
+    }
+
+    if (size == 0) {
+        return 0;
+    }
+
+    // Copy a page at a time
+    for (uint64_t done = 0; done < size;) {
+        uint64_t offset = (relativeAddr + done) & MEM_PAGE_MASK;
+        uint64_t chunk = std::min<uint64_t>(MEM_PAGE_SIZE - offset, size - done);
+        uint8_t *page = touchPage((relativeAddr + done) >> MEM_PAGE_SHIFT);
+        std::memcpy(page + offset, data + done, chunk);
+        done += chunk;
+    }
+
+    if (address < watchEnd && address + size > watchStart && writeWatcher) {
+        writeWatcher(watchOwner, address, size);
+    }
+    return 0;
 }
 
 int MemoryStore::loadFromFile(const char *fileName) {
-    // Open instruction file
-    std::ifstream infile(fileName, std::ios::binary | std::ios::in);
-
-    if (infile) {
-        // Get length of the file and read instruction file into a buffer
-        infile.seekg(0, std::ios::end);
-        int length = infile.tellg();
-        infile.seekg(0, std::ios::beg);
-
-        char *buf = new char[length];
-        infile.read(buf, length);
-        infile.close();
-
-        // Initialize memory store with buffer contents
-        int memLength = length / sizeof(buf[0]);
-        int i;
-        for (i = 0; i < memLength; i++) {
-            this->setMemValue(i * BYTE_SIZE, buf[i], BYTE_SIZE);
+    // Map the program image and copy it into memory in one go
+    int fd = open(fileName, O_RDONLY);
+    struct stat fileStat;
+    if (fd < 0 || fstat(fd, &fileStat) < 0) {
+        if (fd >= 0) {
+            close(fd);
         }
-        return SUCCESS;
-    } else {
         std::cerr << LOG_ERROR << "Unable to open memory file " << fileName << std::endl;
         return ERROR;
     }
+
+    uint64_t length = fileStat.st_size;
+    if (length == 0) {
+        close(fd);
+        return SUCCESS;
+    }
+
+    // Load as much of the image as fits in memory
+    uint64_t memLength = std::min<uint64_t>(length, size);
+    int ret = SUCCESS;
+    void *image = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (image != MAP_FAILED) {
+        writeBlock(startAddr, static_cast<const uint8_t *>(image), memLength);
+        munmap(image, length);
+    } else {
+        // Not mappable (e.g. a pipe), so fall back to reading it
+        std::vector<uint8_t> buf(memLength);
+        uint64_t done = 0;
+        while (done < memLength) {
+            ssize_t n = read(fd, buf.data() + done, memLength - done);
+            if (n <= 0) {
+                break;
+            }
+            done += n;
+        }
+        writeBlock(startAddr, buf.data(), done);
+        if (done < memLength) {
+            std::cerr << LOG_ERROR << "Short read from memory file " << fileName << std::endl;
+            ret = ERROR;
+        }
+    }
+    close(fd);
+
+    if (memLength < length) {
+        std::cerr << LOG_ERROR << "Memory file " << fileName << " does not fit in memory, "
+                  << std::dec << length - memLength << " bytes were not loaded" << std::endl;
+        ret = ERROR;
+    }
+    return ret;
 }
 
 int MemoryStore::printMemArray(uint64_t startAddr, uint64_t endAddr, uint64_t entrySize,
@@ -148,8 +401,11 @@ int MemoryStore::printMemArray(uint64_t startAddr, uint64_t endAddr, uint64_t en
                 if (relStart < relEnd) {
                     out_stream << "0x";
                     for (int j = 0; j < (int)(entrySize); j++) {
+                        if (relStart + j >= size) {
+                            throw std::out_of_range("address past the end of memory");
+                        }
                         out_stream << std::hex << std::setfill('0') << std::setw(BYTE_WIDTH)
-                                   << (uint64_t)(memArr.at(relStart + j));
+                                   << (uint64_t)(readByte(relStart + j));
                     }
                     relStart += entrySize;
                     out_stream << " ";
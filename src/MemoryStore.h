@@ -1,28 +1,141 @@
 #pragma once
 #include <inttypes.h>
 
+#include <cstring>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
-// The memory is 64 KB large.
+// The default memory is 64 KB large.
 #define MEMORY_SIZE 0x10000
 
+// Memory is allocated in pages of MEM_PAGE_SIZE bytes on first write.
+#define MEM_PAGE_SHIFT 12
+#define MEM_PAGE_SIZE (1ull << MEM_PAGE_SHIFT)
+#define MEM_PAGE_MASK (MEM_PAGE_SIZE - 1)
+
 #define BYTE_SHIFT 8
 #define BYTE_WIDTH 2
 #define WORD_WIDTH 8
 
+struct MemPage {
+    uint8_t bytes[MEM_PAGE_SIZE];
+};
+
+// A binary init_mem_image is a MemImageHeader followed by numSegments
+// segments, each a MemImageSegment and then length bytes to store at address.
+// Anything without the magic number is read as the text format of hex
+// address/word pairs.
+#define MEM_IMAGE_MAGIC 0x494d5652  // "RVMI"
+#define MEM_IMAGE_VERSION 1
+
+struct MemImageHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t numSegments;
+};
+
+struct MemImageSegment {
+    uint64_t address;
+    uint64_t length;
+};
+
+class CheckpointWriter;
+class CheckpointReader;
+
 // The various sizes at which you can manipulate the memory.
 enum MemEntrySize { BYTE_SIZE = 1, HALF_SIZE = 2, WORD_SIZE = 4, DOUBLE_SIZE = 8 };
 
 // A memory abstraction interface. Allows values to be set and retrieved at a number of
 // different size granularities. The implementation is also capable of printing out memory
-// values over a given address range.
+// values over a given address range. The address space is sparse: pages are allocated on
+// first write and untouched pages read as zero, so only written memory takes up space.
+// Pages are reference counted so that clone() can share them copy-on-write.
 class MemoryStore {
+   public:
+    // Called after a write that overlaps the watched address range
+    typedef void (*WriteWatcher)(void* owner, uint64_t address, uint64_t size);
+
    private:
     uint64_t startAddr;
-    std::vector<uint8_t> memArr;
+    uint64_t size;
 
+    // Pages indexed by (address - startAddr) >> MEM_PAGE_SHIFT
+    std::unordered_map<uint64_t, std::shared_ptr<MemPage>> pages;
+
+    // Most recently used page, checked before the page table. It may only be
+    // written through while it is not shared with a clone.
+    uint64_t lastPageNum = UINT64_MAX;
+    uint8_t* lastPage = nullptr;
+    bool lastPageWritable = false;
+
+    // Writes into [watchStart, watchEnd) are reported to writeWatcher
+    uint64_t watchStart = 0;
+    uint64_t watchEnd = 0;
+    WriteWatcher writeWatcher = nullptr;
+    void* watchOwner = nullptr;
+
+    // Little-endian access of N bytes at bytes. On a little-endian host this
+    // is a single fixed-size copy, aligned or not.
+    template <uint64_t N>
+    static void accessBytes(bool get, uint8_t* bytes, uint64_t& value) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        if (get) {
+            value = 0;
+            std::memcpy(&value, bytes, N);
+        } else {
+            std::memcpy(bytes, &value, N);
+        }
+#else
+        if (get) {
+            value = 0;
+            for (uint64_t i = 0; i < N; ++i) {
+                value |= ((uint64_t)bytes[i] << (i * 8));
+            }
+        } else {
+            for (uint64_t i = 0; i < N; ++i) {
+                bytes[i] = (value >> (i * 8)) & 0xFF;
+            }
+        }
+#endif
+    }
+
+    // Access within the most recently used page, false if that is not possible
+    bool accessLastPage(bool get, uint64_t address, uint64_t& value, MemEntrySize size) {
+        uint64_t relativeAddr = address - startAddr;
+        uint64_t offset = relativeAddr & MEM_PAGE_MASK;
+        if ((relativeAddr >> MEM_PAGE_SHIFT) != lastPageNum || offset + size > MEM_PAGE_SIZE ||
+            (!get && !lastPageWritable)) {
+            return false;
+        }
+        switch (size) {
+            case BYTE_SIZE:
+                accessBytes<BYTE_SIZE>(get, lastPage + offset, value);
+                return true;
+            case HALF_SIZE:
+                accessBytes<HALF_SIZE>(get, lastPage + offset, value);
+                return true;
+            case WORD_SIZE:
+                accessBytes<WORD_SIZE>(get, lastPage + offset, value);
+                return true;
+            case DOUBLE_SIZE:
+                accessBytes<DOUBLE_SIZE>(get, lastPage + offset, value);
+                return true;
+        }
+        return false;
+    }
+
+    MemoryStore(const MemoryStore& other);
+    MemoryStore& operator=(const MemoryStore&) = delete;
+
+    void cachePage(uint64_t pageNum, uint8_t* page, bool writable);
+    uint8_t* findPage(uint64_t pageNum);
+    uint8_t* touchPage(uint64_t pageNum);
+    uint8_t readByte(uint64_t relativeAddr);
     int getOrSetValue(bool get, uint64_t address, uint64_t& value, MemEntrySize size);
+    int getSlow(uint64_t address, uint64_t& value, MemEntrySize size);
+    int setSlow(uint64_t address, uint64_t value, MemEntrySize size);
 
    public:
     MemoryStore(uint64_t startAddr, uint64_t numEntries);
@@ -30,9 +143,30 @@ class MemoryStore {
     ~MemoryStore(){};
 
     int loadFromFile(const char* fileName);
-    int getMemValue(uint64_t address, uint64_t& value, MemEntrySize size);
-    int setMemValue(uint64_t address, uint64_t value, MemEntrySize size);
+    MemoryStore* clone();
+
+    // Write the size and the non-zero pages to a checkpoint, and replace the
+    // whole contents with those of one (throws std::invalid_argument)
+    void saveCheckpoint(CheckpointWriter& writer) const;
+    void restoreCheckpoint(CheckpointReader& reader);
+
+    int getMemValue(uint64_t address, uint64_t& value, MemEntrySize size) {
+        return accessLastPage(true, address, value, size) ? 0 : getSlow(address, value, size);
+    }
+
+    int setMemValue(uint64_t address, uint64_t value, MemEntrySize size) {
+        bool watched = address < watchEnd && address + size > watchStart;
+        if (!watched && accessLastPage(false, address, value, size)) {
+            return 0;
+        }
+        return setSlow(address, value, size);
+    }
+
+    int writeBlock(uint64_t address, const uint8_t* data, uint64_t size);
     int printMemory(uint64_t startAddress, uint64_t endAddress);
+    uint64_t getSize() const { return size; }
+    uint64_t getNumPages() const { return pages.size(); }
+    void setWriteWatch(uint64_t start, uint64_t end, WriteWatcher watcher, void* owner);
     int printMemArray(uint64_t startAddr, uint64_t endAddr, uint64_t entrySize,
                       uint64_t entriesPerRow, std::ostream& out_stream);
 };
@@ -43,4 +177,5 @@ class MemoryStore {
 // Dumps the section of memory relevant for the test.
 void dumpMemoryState(MemoryStore* mem, const std::string& base_output_name);
 
-int prepareMemory(MemoryStore* mem);
+// Loads the initial memory image, binary or text, if the file exists.
+int prepareMemory(MemoryStore* mem, const char* fileName = "init_mem_image");
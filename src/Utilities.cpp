@@ -396,28 +396,31 @@ static void printInstr(uint32_t curInst, StageStatus status, std::ostream &pipeS
     pipeState << std::left << std::setw(25) << sb.str();
 }
 
+// Size of the user-space buffer behind PipeTraceWriter
+#define PIPE_TRACE_BUFFER_SIZE (1 << 20)
+
+void printPipeState(const PipeState &state, std::ostream &pipe_out) {
+    pipe_out << "Cycle: " << std::right << std::setw(8) << state.cycle << "\t|";
+    pipe_out << "|";
+    printIFPC(state.ifPC, state.ifStatus, pipe_out);
+    pipe_out << "|";
+    printInstr(state.idInstr, state.idStatus, pipe_out);
+    pipe_out << "|";
+    printInstr(state.exInstr, state.exStatus, pipe_out);
+    pipe_out << "|";
+    printInstr(state.memInstr, state.memStatus, pipe_out);
+    pipe_out << "|";
+    printInstr(state.wbInstr, state.wbStatus, pipe_out);
+    pipe_out << "|" << "\n";
+}
+
 Status dumpPipeState(PipeState &state, const std::string &base_output_name) {
-    static auto fileInit = false;
-    auto fileOp = std::ios::app;
-    if (!fileInit) {
-        fileOp = std::ios::out;
-        fileInit = true;
-    }
+    // A new simulation starts the file over at cycle 0
+    auto fileOp = state.cycle == 0 ? std::ios::out : std::ios::app;
     std::ofstream pipe_out(base_output_name + "_pipe_state.out", fileOp);
 
     if (pipe_out) {
-        pipe_out << "Cycle: " << std::setw(8) << state.cycle << "\t|";
-        pipe_out << "|";
-        printIFPC(state.ifPC, state.ifStatus, pipe_out);
-        pipe_out << "|";
-        printInstr(state.idInstr, state.idStatus, pipe_out);
-        pipe_out << "|";
-        printInstr(state.exInstr, state.exStatus, pipe_out);
-        pipe_out << "|";
-        printInstr(state.memInstr, state.memStatus, pipe_out);
-        pipe_out << "|";
-        printInstr(state.wbInstr, state.wbStatus, pipe_out);
-        pipe_out << "|" << std::endl;
+        printPipeState(state, pipe_out);
         return SUCCESS;
     } else {
         std::cerr << LOG_ERROR << "Could not open pipe state file!" << std::endl;
@@ -425,6 +428,86 @@ Status dumpPipeState(PipeState &state, const std::string &base_output_name) {
     }
 }
 
+PipeTraceRecord packPipeState(const PipeState &state) {
+    PipeTraceRecord record = {};
+    record.cycle = state.cycle;
+    record.ifPC = state.ifPC;
+    record.idInstr = state.idInstr;
+    record.exInstr = state.exInstr;
+    record.memInstr = state.memInstr;
+    record.wbInstr = state.wbInstr;
+    record.ifStatus = state.ifStatus;
+    record.idStatus = state.idStatus;
+    record.exStatus = state.exStatus;
+    record.memStatus = state.memStatus;
+    record.wbStatus = state.wbStatus;
+    return record;
+}
+
+PipeState unpackPipeState(const PipeTraceRecord &record) {
+    PipeState state;
+    state.cycle = record.cycle;
+    state.ifPC = record.ifPC;
+    state.idInstr = record.idInstr;
+    state.exInstr = record.exInstr;
+    state.memInstr = record.memInstr;
+    state.wbInstr = record.wbInstr;
+    state.ifStatus = static_cast<StageStatus>(record.ifStatus);
+    state.idStatus = static_cast<StageStatus>(record.idStatus);
+    state.exStatus = static_cast<StageStatus>(record.exStatus);
+    state.memStatus = static_cast<StageStatus>(record.memStatus);
+    state.wbStatus = static_cast<StageStatus>(record.wbStatus);
+    return state;
+}
+
+Status PipeTraceWriter::open(const std::string &base_output_name, PipeTraceFormat traceFormat) {
+    close();
+    format = traceFormat;
+    // The buffer has to be installed before the file is opened
+    buffer.resize(PIPE_TRACE_BUFFER_SIZE);
+    pipe_out.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+
+    if (format == TRACE_BINARY) {
+        pipe_out.open(base_output_name + "_pipe_state.bin",
+                      std::ios::out | std::ios::trunc | std::ios::binary);
+        PipeTraceHeader header = {PIPE_TRACE_MAGIC, PIPE_TRACE_VERSION, sizeof(PipeTraceRecord), 0};
+        pipe_out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    } else {
+        pipe_out.open(base_output_name + "_pipe_state.out", std::ios::out | std::ios::trunc);
+    }
+
+    if (!pipe_out) {
+        std::cerr << LOG_ERROR << "Could not open pipe state file!" << std::endl;
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+Status PipeTraceWriter::write(const PipeState &state) {
+    if (!pipe_out) {
+        return ERROR;
+    }
+    if (format == TRACE_BINARY) {
+        PipeTraceRecord record = packPipeState(state);
+        pipe_out.write(reinterpret_cast<const char *>(&record), sizeof(record));
+    } else {
+        printPipeState(state, pipe_out);
+    }
+    return SUCCESS;
+}
+
+void PipeTraceWriter::flush() {
+    if (pipe_out.is_open()) {
+        pipe_out.flush();
+    }
+}
+
+void PipeTraceWriter::close() {
+    if (pipe_out.is_open()) {
+        pipe_out.close();
+    }
+}
+
 Status dumpSimStats(SimulationStats &stats, const std::string &base_output_name) {
     std::ofstream simStats(base_output_name + "_sim_stats.out");
 
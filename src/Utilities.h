@@ -8,6 +8,7 @@
 #include <iostream>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #define NUM_REGS 32
 
@@ -146,6 +147,96 @@ uint64_t sext64(uint64_t imm, int signBit);
 Status dumpPipeState(PipeState& state, const std::string& base_output_name);
 Status dumpSimStats(SimulationStats& stats, const std::string& base_output_name);
 
+enum PipeTraceMode {
+    TRACE_FULL = 0,  // trace every cycle
+    TRACE_OFF,       // no pipe state trace at all
+    TRACE_SAMPLED,   // trace every interval-th cycle
+    TRACE_WINDOW,    // trace cycles in [windowStart, windowEnd]
+};
+
+enum PipeTraceFormat {
+    TRACE_TEXT = 0,  // _pipe_state.out, same as dumpPipeState()
+    TRACE_BINARY,    // _pipe_state.bin, fixed-width PipeTraceRecords
+};
+
+// Which cycles end up in the pipe state trace, and in which format
+struct PipeTraceConfig {
+    PipeTraceMode mode = TRACE_FULL;
+    PipeTraceFormat format = TRACE_TEXT;
+    uint64_t interval = 1;
+    uint64_t windowStart = 0;
+    uint64_t windowEnd = 0;
+
+    bool enabled() const { return mode != TRACE_OFF; }
+
+    bool shouldTrace(uint64_t cycle) const {
+        switch (mode) {
+            case TRACE_FULL:
+                return true;
+            case TRACE_SAMPLED:
+                return cycle % interval == 0;
+            case TRACE_WINDOW:
+                return cycle >= windowStart && cycle <= windowEnd;
+            default:
+                return false;
+        }
+    }
+};
+
+// Binary pipe trace layout: a PipeTraceHeader followed by one
+// PipeTraceRecord per traced cycle, both in host (little-endian) byte order.
+#define PIPE_TRACE_MAGIC 0x54505652  // "RVPT"
+#define PIPE_TRACE_VERSION 1
+
+struct PipeTraceHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t reserved;
+};
+
+struct PipeTraceRecord {
+    uint64_t cycle;
+    uint64_t ifPC;
+    uint32_t idInstr;
+    uint32_t exInstr;
+    uint32_t memInstr;
+    uint32_t wbInstr;
+    uint8_t ifStatus;
+    uint8_t idStatus;
+    uint8_t exStatus;
+    uint8_t memStatus;
+    uint8_t wbStatus;
+    uint8_t reserved[3];
+};
+
+PipeTraceRecord packPipeState(const PipeState& state);
+PipeState unpackPipeState(const PipeTraceRecord& record);
+
+// Print one cycle in the text pipe trace format
+void printPipeState(const PipeState& state, std::ostream& pipe_out);
+
+// Persistent pipe state trace. The output file is opened once and written
+// through a large block buffer, instead of being reopened for every cycle
+// like dumpPipeState() does. The text format is identical; the binary
+// format can be turned back into it with pipe_decode.
+class PipeTraceWriter {
+   private:
+    std::ofstream pipe_out;
+    std::vector<char> buffer;
+    PipeTraceFormat format = TRACE_TEXT;
+
+   public:
+    PipeTraceWriter() = default;
+    ~PipeTraceWriter() { close(); }
+
+    Status open(const std::string& base_output_name, PipeTraceFormat traceFormat = TRACE_TEXT);
+    Status write(const PipeState& state);
+    void flush();
+    void close();
+    bool isOpen() const { return pipe_out.is_open(); }
+};
+
 // handle output file names
 inline std::string getBaseFilename(const char* inputPath) {
     std::string path(inputPath);
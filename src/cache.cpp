@@ -1,83 +1,498 @@
 #include "cache.h"
+#include <algorithm>
 #include <fstream>
-#include <random>
+#include <sstream>
+#include <stdexcept>
+
+#include "checkpoint.h"
 
 using namespace std;
 
+const uint64_t Cache::INVALID_TAG;
+
 // Constructor definition
 Cache::Cache(CacheConfig configParam, CacheDataType cacheType)
     : hits(0),
       misses(0),
+      writebacks(0),
+      writeThroughs(0),
+      lastPenalty(0),
       type(cacheType),
       config(configParam) {
+    if (isIdeal()) {
+        numberOfSets = blockOffsetBits = setIndexBits = 0;
+        return;
+    }
+    checkCacheGeometry(config, type == I_CACHE   ? "I-cache"
+                               : type == D_CACHE ? "D-cache"
+                                                 : "Unified cache");
     // Derive geometry from configuration
     computeGeometry();
-    // Initialize set structures
-    sets.resize(numberOfSets);
-    for (auto& set : sets) {
-        set.resize(config.ways);
-        for (auto& line : set) {
-            line.isValid = false;
-            line.tag = 0;
-            line.lruTimestamp = 0;
+    // Initialize the tag store, all lines invalid
+    tags.assign(numberOfSets * config.ways, INVALID_TAG);
+    dirty.assign(numberOfSets * config.ways, 0);
+    policy = ReplacementPolicy::create(config.replacement, numberOfSets, config.ways, config.seed);
+}
+
+static bool isPowerOfTwo(uint64_t value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+void checkCacheGeometry(const CacheConfig& config, const string& name) {
+    if (config.cacheSize == 0) {
+        return;
+    }
+    if (!isPowerOfTwo(config.blockSize) || config.ways == 0) {
+        throw invalid_argument(name + " needs a power-of-two block size and at least one way");
+    }
+    // Divide first, so that a huge block size or way count cannot overflow
+    if (config.cacheSize / config.blockSize < config.ways ||
+        config.cacheSize % (config.blockSize * config.ways) != 0 ||
+        !isPowerOfTwo(config.cacheSize / (config.blockSize * config.ways))) {
+        stringstream errorMessage;
+        errorMessage << name << " size " << config.cacheSize << " is not a power-of-two number of "
+                     << config.ways << "-way sets of " << config.blockSize << " byte blocks";
+        throw invalid_argument(errorMessage.str());
+    }
+}
+
+static const char* const INCLUSION_NAMES[] = {"nine", "inclusive", "exclusive"};
+
+const char* inclusionName(InclusionPolicy inclusion) {
+    return INCLUSION_NAMES[inclusion];
+}
+
+void setCacheProperty(CacheConfig& config, const string& property, const string& value) {
+    if (property == "size") {
+        config.cacheSize = stoull(value, nullptr, 0);
+    } else if (property == "block_size") {
+        config.blockSize = stoull(value, nullptr, 0);
+    } else if (property == "ways") {
+        config.ways = stoull(value, nullptr, 0);
+    } else if (property == "miss_latency") {
+        config.missLatency = stoull(value, nullptr, 0);
+    } else if (property == "replacement") {
+        config.replacement = parseReplacementKind(value);
+    } else if (property == "seed") {
+        config.seed = stoull(value, nullptr, 0);
+    } else if (property == "write_policy") {
+        if (value != "write-back" && value != "write-through") {
+            throw invalid_argument("write_policy is write-back or write-through, not " + value);
         }
+        config.writeBack = value == "write-back";
+    } else if (property == "write_miss") {
+        if (value != "allocate" && value != "no-allocate") {
+            throw invalid_argument("write_miss is allocate or no-allocate, not " + value);
+        }
+        config.writeAllocate = value == "allocate";
+    } else if (property == "writeback_latency") {
+        config.writebackLatency = stoull(value, nullptr, 0);
+    } else if (property == "inclusion") {
+        for (int inclusion = INCLUSION_NINE; inclusion <= INCLUSION_EXCLUSIVE; inclusion++) {
+            if (value == INCLUSION_NAMES[inclusion]) {
+                config.inclusion = static_cast<InclusionPolicy>(inclusion);
+                return;
+            }
+        }
+        throw invalid_argument("inclusion is nine, inclusive or exclusive, not " + value);
+    } else {
+        throw invalid_argument("Unknown cache property " + property);
+    }
+}
+
+void readCacheConfigFile(const string& fileName, CacheConfig& icConfig, CacheConfig& dcConfig,
+                         vector<CacheConfig>& lowerLevels) {
+    ifstream file(fileName);
+    if (!file.is_open()) {
+        throw invalid_argument("Failed to open cache config file: " + fileName);
+    }
+
+    int line = 0;
+    auto parseNextLine = [&](const char* name) -> uint32_t {
+        line++;
+        uint32_t value;
+        if (!(file >> value)) {
+            stringstream errorMessage;
+            errorMessage << "Failed to parse property at line " << line << " for property "
+                         << name;
+            throw invalid_argument(errorMessage.str());
+        }
+        string discard;
+        getline(file, discard);  // discard rest of the line
+        return value;
+    };
+
+    icConfig = CacheConfig{parseNextLine("ICache cache size"), parseNextLine("ICache block size"),
+                           parseNextLine("ICache ways"), parseNextLine("ICache miss latency")};
+
+    dcConfig = CacheConfig{parseNextLine("DCache cache size"), parseNextLine("DCache block size"),
+                           parseNextLine("DCache ways"), parseNextLine("DCache miss latency")};
+
+    // Optional "<icache|dcache|l2|l3>.<property>=<value>" lines, '#' starts a comment
+    CacheConfig l2Config{0, 0, 0, 0};
+    CacheConfig l3Config{0, 0, 0, 0};
+    auto trim = [](const string& text) {
+        size_t first = text.find_first_not_of(" \t\r");
+        size_t last = text.find_last_not_of(" \t\r");
+        return first == string::npos ? string() : text.substr(first, last - first + 1);
+    };
+    string entry;
+    while (getline(file, entry)) {
+        line++;
+        entry = trim(entry.substr(0, entry.find('#')));
+        if (entry.empty()) {
+            continue;
+        }
+        size_t dot = entry.find('.');
+        size_t equals = entry.find('=');
+        if (dot == string::npos || equals == string::npos || dot > equals) {
+            stringstream errorMessage;
+            errorMessage << "Expected <cache>.<property>=<value> at line " << line;
+            throw invalid_argument(errorMessage.str());
+        }
+        string cacheName = trim(entry.substr(0, dot));
+        CacheConfig* config = cacheName == "icache" ? &icConfig
+                              : cacheName == "dcache" ? &dcConfig
+                              : cacheName == "l2"     ? &l2Config
+                              : cacheName == "l3"     ? &l3Config
+                                                      : nullptr;
+        if (!config) {
+            throw invalid_argument("Unknown cache " + cacheName);
+        }
+        setCacheProperty(*config, trim(entry.substr(dot + 1, equals - dot - 1)),
+                         trim(entry.substr(equals + 1)));
+    }
+
+    checkCacheGeometry(icConfig, "I-cache");
+    checkCacheGeometry(dcConfig, "D-cache");
+    lowerLevels.clear();
+    for (const CacheConfig& config : {l2Config, l3Config}) {
+        if (config.cacheSize == 0) {
+            break;
+        }
+        checkCacheGeometry(config, lowerLevels.empty() ? "L2" : "L3");
+        lowerLevels.push_back(config);
+    }
+    if (l3Config.cacheSize != 0 && l2Config.cacheSize == 0) {
+        throw invalid_argument("An L3 needs an L2");
     }
 }
 
 // Access method definition
 bool Cache::access(uint64_t address, CacheOperation readWrite) {
-    // Compute set index and tag from address 
+    bool movedDirty;
+    return lookup(address, readWrite, movedDirty);
+}
+
+// Access from the pipeline or from a level above. An exclusive cache hands a
+// line it hits on a read up to the requester, movedDirty tells whether it was
+// dirty.
+bool Cache::lookup(uint64_t address, CacheOperation readWrite, bool& movedDirty) {
+    lastPenalty = 0;
+    movedDirty = false;
+    if (isIdeal()) {
+        return true;
+    }
+
+    // Compute set index and tag from address
     auto indexAndTag = getIndexAndTag(address);
     uint64_t setIndex = indexAndTag.first;
     uint64_t tag = indexAndTag.second;
-    auto& set = sets[setIndex];
-
-    // Probe for hit
-    int hitLineIndex = -1;
-    for (int way = 0; way < static_cast<int>(config.ways); ++way) {
-        if (set[way].isValid && set[way].tag == tag) {
-            hitLineIndex = way;
-            break;
-        }
-    }
+    bool isWrite = readWrite == CACHE_WRITE;
+    // A write-through cache passes every store on, after its own fill so that
+    // the fill read still sees the next level as it was
+    bool writesThrough = isWrite && !config.writeBack;
 
-    // Hit, update LRU
-    if (hitLineIndex >= 0) {  
+    // Hit, update the replacement state
+    uint64_t hitWay;
+    if (probe(setIndex, tag, hitWay)) {
         hits++;
-        set[hitLineIndex].lruTimestamp = ++lruClock;
+        uint64_t index = setIndex * config.ways + hitWay;
+        if (exclusive() && !isWrite) {
+            movedDirty = dirty[index];
+            tags[index] = INVALID_TAG;
+            dirty[index] = 0;
+        } else {
+            policy->onHit(setIndex, hitWay);
+            dirty[index] |= isWrite && config.writeBack;
+        }
+        if (writesThrough) {
+            writeThroughs++;
+            writeNext(address);
+        }
         return true;
     }
 
     //Miss path
     misses++;
+    if (isWrite && (!config.writeAllocate || exclusive())) {
+        // The store goes on to the next level without a fill
+        if (writesThrough) {
+            writeThroughs++;
+        }
+        writeNext(address);
+        return false;
+    }
 
-    // Choose a victim
-    int victimIndex = -1;
-    for (int way = 0; way < static_cast<int>(config.ways); ++way) {
-        if (!set[way].isValid) {
-            victimIndex = way;
-            break;
+    // Read the line from the next level, then make room for it here
+    bool fillDirty = isWrite && config.writeBack;
+    lastPenalty = config.missLatency;
+    if (nextLevel) {
+        bool nextMovedDirty;
+        nextLevel->lookup(address, CACHE_READ, nextMovedDirty);
+        lastPenalty += nextLevel->lastPenalty;
+        fillDirty |= nextMovedDirty;
+    }
+    if (exclusive()) {
+        // Only lines evicted from above are filled in
+        return false;
+    }
+    uint64_t victimWay = chooseVictim(setIndex);
+    if (evict(setIndex, victimWay)) {
+        lastPenalty += config.writebackLatency;
+    }
+    fill(setIndex, victimWay, tag, fillDirty);
+    if (writesThrough) {
+        writeThroughs++;
+        writeNext(address);
+    }
+    return false;
+}
+
+// Probe for hit. The tags of a set are distinct, so at most one way matches;
+// or-ing the matching way into hitWay instead of breaking out of the loop
+// lets the compiler compare several ways per instruction.
+bool Cache::probe(uint64_t setIndex, uint64_t tag, uint64_t& hitWay) const {
+    const uint64_t ways = config.ways;
+    const uint64_t* setTags = &tags[setIndex * ways];
+    uint64_t found = 0;
+    uint64_t matchWay = 0;
+    for (uint64_t way = 0; way < ways; ++way) {
+        uint64_t match = 0 - static_cast<uint64_t>(setTags[way] == tag);
+        found |= match;
+        matchWay |= match & way;
+    }
+    hitWay = matchWay;
+    return found != 0;
+}
+
+// The first invalid way, else the one the policy picks
+uint64_t Cache::chooseVictim(uint64_t setIndex) {
+    const uint64_t* setTags = &tags[setIndex * config.ways];
+    for (uint64_t way = 0; way < config.ways; ++way) {
+        if (setTags[way] == INVALID_TAG) {
+            return way;
+        }
+    }
+    return policy->victim(setIndex);
+}
+
+// Drop the line at (setIndex, way). An inclusive cache first takes it out of
+// the levels above. A dirty line is written back to the next level, and an
+// exclusive next level takes clean lines as well.
+// @return whether a dirty line was written back
+bool Cache::evict(uint64_t setIndex, uint64_t way) {
+    uint64_t index = setIndex * config.ways + way;
+    if (tags[index] == INVALID_TAG) {
+        return false;
+    }
+    uint64_t address = lineAddress(setIndex, tags[index]);
+    bool isDirty = dirty[index];
+    tags[index] = INVALID_TAG;
+    dirty[index] = 0;
+
+    if (config.inclusion == INCLUSION_INCLUSIVE) {
+        for (Cache* upper : upperLevels) {
+            isDirty |= upper->invalidate(address, config.blockSize);
+        }
+    }
+    if (isDirty) {
+        writebacks++;
+    }
+    if (nextLevel && (isDirty || nextLevel->exclusive())) {
+        nextLevel->install(address, isDirty);
+    }
+    return isDirty;
+}
+
+void Cache::fill(uint64_t setIndex, uint64_t way, uint64_t tag, bool isDirty) {
+    uint64_t index = setIndex * config.ways + way;
+    tags[index] = tag;
+    dirty[index] = isDirty;
+    policy->onFill(setIndex, way);
+}
+
+// Pass a store on to the next level, memory takes it otherwise
+void Cache::writeNext(uint64_t address) {
+    if (nextLevel) {
+        nextLevel->postWrite(address);
+    }
+}
+
+// Take a store passed on by a level above through its write buffer. Like
+// install() this is not a demand access: it counts no hit or miss and costs
+// no cycles. An exclusive cache only updates a line it already holds.
+void Cache::postWrite(uint64_t address) {
+    if (isIdeal()) {
+        return;
+    }
+    auto indexAndTag = getIndexAndTag(address);
+    uint64_t setIndex = indexAndTag.first;
+    uint64_t tag = indexAndTag.second;
+    uint64_t way;
+    if (probe(setIndex, tag, way)) {
+        if (config.writeBack) {
+            dirty[setIndex * config.ways + way] = 1;
+            return;
+        }
+    } else if (config.writeAllocate && !exclusive()) {
+        way = chooseVictim(setIndex);
+        evict(setIndex, way);
+        fill(setIndex, way, tag, config.writeBack);
+        if (config.writeBack) {
+            return;
+        }
+    }
+    if (!config.writeBack) {
+        writeThroughs++;
+    }
+    writeNext(address);
+}
+
+// Take a line written back or evicted by a level above. This is not an access
+// of this cache, so it does not count as a hit or miss and costs no cycles.
+void Cache::install(uint64_t address, bool isDirty) {
+    if (isIdeal()) {
+        return;
+    }
+    if (isDirty && !config.writeBack) {
+        writeThroughs++;
+        if (nextLevel) {
+            nextLevel->install(address, true);
+        }
+        isDirty = false;
+    }
+
+    auto indexAndTag = getIndexAndTag(address);
+    uint64_t setIndex = indexAndTag.first;
+    uint64_t tag = indexAndTag.second;
+    uint64_t way;
+    if (probe(setIndex, tag, way)) {
+        dirty[setIndex * config.ways + way] |= isDirty;
+        return;
+    }
+    if (!exclusive() && !config.writeAllocate) {
+        if (isDirty && nextLevel) {
+            nextLevel->install(address, true);
         }
+        return;
     }
-    // If all valid, evict true LRU
-    if (victimIndex < 0) {
-        uint64_t minTimestamp = set[0].lruTimestamp;
-        victimIndex = 0;
-        for (int way = 1; way < static_cast<int>(config.ways); ++way) {
-            if (set[way].lruTimestamp < minTimestamp) {
-                minTimestamp = set[way].lruTimestamp;
-                victimIndex = way;
+    way = chooseVictim(setIndex);
+    evict(setIndex, way);
+    fill(setIndex, way, tag, isDirty);
+}
+
+// Drop the blocks of [address, address + size) from this cache and from the
+// levels above it
+// @return whether any of them was dirty
+bool Cache::invalidate(uint64_t address, uint64_t size) {
+    bool isDirty = false;
+    if (!isIdeal()) {
+        uint64_t block = address - address % config.blockSize;
+        for (; block < address + size; block += config.blockSize) {
+            auto indexAndTag = getIndexAndTag(block);
+            uint64_t way;
+            if (probe(indexAndTag.first, indexAndTag.second, way)) {
+                uint64_t index = indexAndTag.first * config.ways + way;
+                isDirty |= dirty[index] != 0;
+                tags[index] = INVALID_TAG;
+                dirty[index] = 0;
             }
         }
     }
+    for (Cache* upper : upperLevels) {
+        isDirty |= upper->invalidate(address, size);
+    }
+    return isDirty;
+}
+
+void Cache::setNextLevel(Cache* next) {
+    if (!isIdeal() && next->config.blockSize < config.blockSize) {
+        throw invalid_argument(
+            "A lower cache level needs blocks at least as large as the ones above");
+    }
+    if (!isIdeal() && next->exclusive() && next->config.blockSize != config.blockSize) {
+        throw invalid_argument(
+            "An exclusive cache level needs the block size of the ones above");
+    }
+    nextLevel = next;
+    next->upperLevels.push_back(this);
+}
 
-    // Fill the line 
-    set[victimIndex].isValid = true;
-    set[victimIndex].tag = tag;
-    set[victimIndex].lruTimestamp = ++lruClock;
+void Cache::reset() {
+    resetCounters();
+    if (isIdeal()) {
+        return;
+    }
+    fill_n(tags.begin(), tags.size(), INVALID_TAG);
+    fill_n(dirty.begin(), dirty.size(), 0);
+    policy = ReplacementPolicy::create(config.replacement, numberOfSets, config.ways, config.seed);
+}
 
-    (void)readWrite; 
-    return false;
+void Cache::resetCounters() {
+    hits = misses = writebacks = writeThroughs = lastPenalty = 0;
+}
+
+void Cache::saveCheckpoint(CheckpointWriter& writer) const {
+    writer.put<uint32_t>(CHECKPOINT_TAG_CACHE);
+    writer.put(config.cacheSize);
+    writer.put(config.blockSize);
+    writer.put(config.ways);
+    writer.put(config.replacement);
+    writer.put(config.seed);
+    writer.put<uint8_t>(config.writeBack);
+    writer.put<uint8_t>(config.writeAllocate);
+    writer.put(config.inclusion);
+    writer.put(hits);
+    writer.put(misses);
+    writer.put(writebacks);
+    writer.put(writeThroughs);
+    writer.put(lastPenalty);
+    if (isIdeal()) {
+        return;
+    }
+    writer.putBytes(tags.data(), tags.size() * sizeof(tags[0]));
+    writer.putBytes(dirty.data(), dirty.size() * sizeof(dirty[0]));
+    policy->saveCheckpoint(writer);
+}
+
+void Cache::restoreCheckpoint(CheckpointReader& reader) {
+    reader.expectTag(CHECKPOINT_TAG_CACHE);
+    uint64_t cacheSize = reader.get<uint64_t>();
+    uint64_t blockSize = reader.get<uint64_t>();
+    uint64_t ways = reader.get<uint64_t>();
+    ReplacementKind replacement = reader.get<ReplacementKind>();
+    uint64_t seed = reader.get<uint64_t>();
+    bool writeBack = reader.get<uint8_t>();
+    bool writeAllocate = reader.get<uint8_t>();
+    InclusionPolicy inclusion = reader.get<InclusionPolicy>();
+    if (cacheSize != config.cacheSize || blockSize != config.blockSize || ways != config.ways ||
+        replacement != config.replacement || seed != config.seed ||
+        writeBack != config.writeBack || writeAllocate != config.writeAllocate ||
+        inclusion != config.inclusion) {
+        throw invalid_argument("The checkpoint was taken with another cache configuration");
+    }
+    hits = reader.get<uint64_t>();
+    misses = reader.get<uint64_t>();
+    writebacks = reader.get<uint64_t>();
+    writeThroughs = reader.get<uint64_t>();
+    lastPenalty = reader.get<uint64_t>();
+    if (isIdeal()) {
+        return;
+    }
+    reader.getBytes(tags.data(), tags.size() * sizeof(tags[0]));
+    reader.getBytes(dirty.data(), dirty.size() * sizeof(dirty[0]));
+    policy->restoreCheckpoint(reader);
 }
 
 // debug: dump information as you needed, here are some examples
@@ -92,6 +507,11 @@ Status Cache::dump(const std::string& base_output_name) {
         cache_out << "Block Size: " << config.blockSize << " bytes" << std::endl;
         cache_out << "Ways: " << config.ways << std::endl;
         cache_out << "Miss Latency: " << config.missLatency << " cycles" << std::endl;
+        cache_out << "Replacement: " << replacementName(config.replacement) << std::endl;
+        cache_out << "Write Policy: " << (config.writeBack ? "write-back" : "write-through")
+                  << ", " << (config.writeAllocate ? "allocate" : "no-allocate") << std::endl;
+        cache_out << "Writeback Latency: " << config.writebackLatency << " cycles" << std::endl;
+        cache_out << "Inclusion: " << inclusionName(config.inclusion) << std::endl;
         cache_out << "Derived Geometry:" << std::endl;
         cache_out << "Sets: " << numberOfSets << std::endl;
         cache_out << "Block Offset Bits: " << blockOffsetBits << std::endl;
@@ -99,6 +519,8 @@ Status Cache::dump(const std::string& base_output_name) {
         cache_out << "Statistics:" << std::endl;
         cache_out << "Hits: " << hits << std::endl;
         cache_out << "Misses: " << misses << std::endl;
+        cache_out << "Writebacks: " << writebacks << std::endl;
+        cache_out << "Write-throughs: " << writeThroughs << std::endl;
         cache_out << "---------------------" << endl;
         cache_out << "End Register Values" << endl;
         cache_out << "---------------------" << endl;
@@ -1,48 +1,118 @@
 #pragma once
 #include <inttypes.h>
 #include <iostream>
+#include <memory>
+#include <string>
 #include <vector>
 #include "Utilities.h"
+#include "replacement.h"
+
+// How a lower level (L2, L3) relates to the contents of the levels above it
+enum InclusionPolicy {
+    INCLUSION_NINE = 0,   // neither inclusive nor exclusive, lines come and go independently
+    INCLUSION_INCLUSIVE,  // evicting a line also invalidates it in the levels above
+    INCLUSION_EXCLUSIVE,  // holds only lines evicted from above, a hit moves the line up
+};
+
+// name used in cache_config.txt, "nine", "inclusive" or "exclusive"
+const char* inclusionName(InclusionPolicy inclusion);
 
 struct CacheConfig {
-    // Cache size in bytes.
+    // Cache size in bytes. A size of 0 models an ideal cache that always hits
+    // and keeps no statistics.
     uint64_t cacheSize;
     // Cache block size in bytes.
     uint64_t blockSize;
     // Type of cache: set associativity
     uint64_t ways;
-    // Additional miss latency in cycles.
+    // Additional miss latency in cycles. With a next level this is the time
+    // to reach it, and a miss there adds that level's latency on top.
     uint64_t missLatency;
+    // Replacement policy, and the seed of the policies that use random numbers
+    ReplacementKind replacement = REPL_LRU;
+    uint64_t seed = 1;
+    // Write-back keeps stores in dirty lines until they are evicted,
+    // write-through (the default) passes every store on to the next level
+    bool writeBack = false;
+    // Whether a store that misses fills the line
+    bool writeAllocate = true;
+    // Extra cycles of a miss that evicts a dirty line
+    uint64_t writebackLatency = 0;
+    // Only used by L2 and L3
+    InclusionPolicy inclusion = INCLUSION_NINE;
     // debug: Overload << operator to allow easy printing of CacheConfig
     friend std::ostream& operator<<(std::ostream& os, const CacheConfig& config) {
         os << "CacheConfig { " << config.cacheSize << ", " << config.blockSize << ", "
-           << config.ways << ", " << config.missLatency << " }";
+           << config.ways << ", " << config.missLatency << ", "
+           << replacementName(config.replacement) << ", "
+           << (config.writeBack ? "write-back" : "write-through") << ", "
+           << (config.writeAllocate ? "allocate" : "no-allocate") << ", "
+           << inclusionName(config.inclusion) << " }";
         return os;
     }
 };
 
-enum CacheDataType { I_CACHE = false, D_CACHE = true };
+/** Set one of the optional properties that follow the numeric lines of
+ * cache_config.txt, throws std::invalid_argument for an unknown property or
+ * a bad value
+ * @param
+ *      config: cache to configure
+ *      property: "size", "block_size", "ways", "miss_latency", "replacement" (lru,
+ *                plru, fifo, random, nru, srrip, brrip), "seed", "write_policy"
+ *                (write-back, write-through), "write_miss" (allocate, no-allocate),
+ *                "writeback_latency" or "inclusion" (nine, inclusive, exclusive)
+ *      value: property value
+ */
+void setCacheProperty(CacheConfig& config, const std::string& property, const std::string& value);
+
+/** Check that config describes a cache that can be built: an ideal one, or
+ * one of at least one way of power-of-two blocks in a power-of-two number of
+ * sets. Throws std::invalid_argument, naming the cache, otherwise.
+ */
+void checkCacheGeometry(const CacheConfig& config, const std::string& name);
+
+/** Read cache_config.txt: the I-cache and D-cache size, block size, ways and
+ * miss latency on eight lines, then optional "<icache|dcache|l2|l3>.<property>=<value>"
+ * lines, '#' starting a comment. Throws std::invalid_argument (or
+ * std::out_of_range) if the file cannot be read or has a bad entry.
+ * @param
+ *      fileName: the file to read
+ *      icConfig, dcConfig: the L1 caches
+ *      lowerLevels: the L2 and L3, if configured, L2 first
+ */
+void readCacheConfigFile(const std::string& fileName, CacheConfig& icConfig,
+                         CacheConfig& dcConfig, std::vector<CacheConfig>& lowerLevels);
+
+enum CacheDataType { I_CACHE = 0, D_CACHE, UNIFIED_CACHE };
 enum CacheOperation { CACHE_READ = false, CACHE_WRITE = true };
 
 class Cache {
 private:
     uint64_t hits, misses;
+    uint64_t writebacks;     // dirty lines evicted
+    uint64_t writeThroughs;  // stores passed on by a write-through cache
+    uint64_t lastPenalty;    // cycles the last access added, see getLastPenalty()
     CacheDataType type;
     uint64_t numberOfSets;
     uint64_t blockOffsetBits;
     uint64_t setIndexBits;
 
-    struct CacheLine {
-        bool isValid;
-        uint64_t tag;
-        uint64_t lruTimestamp;
-    };
+    // No address maps to this tag, so invalid lines never match a probe
+    static const uint64_t INVALID_TAG = UINT64_MAX;
 
-    // One vector per set
-    std::vector<std::vector<CacheLine>> sets;
+    // Tag store of all lines, indexed by set * ways + way. Invalid lines
+    // hold INVALID_TAG.
+    std::vector<uint64_t> tags;
+    // Dirty bit of each line, same indexing
+    std::vector<uint8_t> dirty;
 
-    // Timestamp for LRU
-    uint64_t lruClock = 0;
+    // Decides which line of a full set to evict
+    std::unique_ptr<ReplacementPolicy> policy;
+
+    // Next level towards memory (nullptr for memory itself), and the levels
+    // that miss into this one
+    Cache* nextLevel = nullptr;
+    std::vector<Cache*> upperLevels;
 
     inline uint64_t maskForBits(uint64_t bitCount) const {
         if (bitCount == 0) return 0ULL;
@@ -68,6 +138,21 @@ private:
         return {setIndex, tag};
     }
 
+    inline uint64_t lineAddress(uint64_t setIndex, uint64_t tag) const {
+        return (tag << (blockOffsetBits + setIndexBits)) | (setIndex << blockOffsetBits);
+    }
+
+    bool exclusive() const { return config.inclusion == INCLUSION_EXCLUSIVE; }
+    bool lookup(uint64_t address, CacheOperation readWrite, bool& movedDirty);
+    bool probe(uint64_t setIndex, uint64_t tag, uint64_t& hitWay) const;
+    uint64_t chooseVictim(uint64_t setIndex);
+    bool evict(uint64_t setIndex, uint64_t way);
+    void fill(uint64_t setIndex, uint64_t way, uint64_t tag, bool isDirty);
+    void writeNext(uint64_t address);
+    void postWrite(uint64_t address);
+    void install(uint64_t address, bool isDirty);
+    bool invalidate(uint64_t address, uint64_t size);
+
 public:
     CacheConfig config;
     // Constructor to initialize the cache parameters
@@ -77,10 +162,36 @@ public:
      * @return true for hit and false for miss
      * @param
      *      address: memory address
-     *      readWrite: true for read operation and false for write operation
+     *      readWrite: CACHE_READ or CACHE_WRITE
      */
     bool access(uint64_t address, CacheOperation readWrite);
 
+    // Stall cycles of the last access: 0 for a hit, missLatency plus the
+    // penalty of the next level for a miss, plus writebackLatency if it
+    // evicted a dirty line. Stores to the next level go through a write
+    // buffer, so a store miss that does not allocate costs nothing.
+    uint64_t getLastPenalty() const { return lastPenalty; }
+
+    // Misses of this cache go to next, which may be shared with other
+    // caches. Without a next level, misses go to memory.
+    void setNextLevel(Cache* next);
+
+    bool isIdeal() const { return config.cacheSize == 0; }
+
+    // Empty the cache and zero its counters, as if it were just built; the
+    // links to the other levels stay
+    void reset();
+
+    // Zero the counters but keep the lines, so that the statistics only
+    // cover the accesses from now on (after warming the cache up, say)
+    void resetCounters();
+
+    // Write the counters, lines and replacement state to a checkpoint, and
+    // read them back into a cache of the same geometry and policy (throws
+    // std::invalid_argument otherwise)
+    void saveCheckpoint(CheckpointWriter& writer) const;
+    void restoreCheckpoint(CheckpointReader& reader);
+
     // debug: dump information as you needed
     Status dump(const std::string& base_output_name);
 
@@ -88,6 +199,8 @@ public:
 
     uint64_t getHits() { return hits; }
     uint64_t getMisses() { return misses; }
+    uint64_t getWritebacks() const { return writebacks; }
+    uint64_t getWriteThroughs() const { return writeThroughs; }
     uint64_t getNumberOfSets() const { return numberOfSets; }
     uint64_t getBlockOffsetBits() const { return blockOffsetBits; }
     uint64_t getSetIndexBits() const { return setIndexBits; }
@@ -0,0 +1,154 @@
+#include "checkpoint.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+uint64_t CheckpointOptions::next(uint64_t now) const {
+    uint64_t nextCount = at > now ? at : 0;
+    if (every != 0) {
+        uint64_t periodic = (now / every + 1) * every;
+        nextCount = nextCount == 0 ? periodic : min(nextCount, periodic);
+    }
+    return nextCount;
+}
+
+bool CheckpointOptions::parse(const string& arg) {
+    if (arg.compare(0, 16, "--checkpoint-at=") == 0) {
+        at = stoull(arg.substr(16));
+    } else if (arg.compare(0, 19, "--checkpoint-every=") == 0) {
+        every = stoull(arg.substr(19));
+    } else if (arg.compare(0, 10, "--restore=") == 0) {
+        restoreFile = arg.substr(10);
+        if (restoreFile.empty()) {
+            throw invalid_argument("--restore needs a checkpoint file");
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+Status CheckpointWriter::open(const string& fileName, CheckpointKind kind) {
+    out.open(fileName, ios::out | ios::trunc | ios::binary);
+    if (!out) {
+        cerr << LOG_ERROR << "Could not open checkpoint file " << fileName << endl;
+        return ERROR;
+    }
+    CheckpointHeader header = {CHECKPOINT_MAGIC, CHECKPOINT_VERSION, kind, 0};
+    putBytes(&header, sizeof(header));
+    return SUCCESS;
+}
+
+// Field by field, so that the file does not depend on the latch layout
+void CheckpointWriter::putInstruction(const Simulator::Instruction& inst) {
+    put(inst.PC);
+    put(inst.instruction);
+    put(inst.opcode);
+    put(inst.funct3);
+    put(inst.funct7);
+    put(inst.rd);
+    put(inst.rs1);
+    put(inst.rs2);
+    uint16_t flags = inst.isHalt | inst.isLegal << 1 | inst.isNop << 2 | inst.readsMem << 3 |
+                     inst.writesMem << 4 | inst.doesArithLogic << 5 | inst.writesRd << 6 |
+                     inst.readsRs1 << 7 | inst.readsRs2 << 8 | inst.memException << 9 |
+                     inst.isBubble << 10;
+    put(flags);
+    put<uint8_t>(inst.status);
+    put(inst.imm);
+    put(inst.nextPC);
+    put(inst.op1Val);
+    put(inst.op2Val);
+    put(inst.arithResult);
+    put(inst.memAddress);
+    put(inst.memResult);
+    put(inst.instructionID);
+}
+
+Status CheckpointWriter::close() {
+    out.close();
+    if (!out) {
+        cerr << LOG_ERROR << "Could not write checkpoint file!" << endl;
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+CheckpointKind CheckpointReader::open(const string& name) {
+    fileName = name;
+    in.open(fileName, ios::in | ios::binary);
+    if (!in) {
+        throw invalid_argument("Unable to open checkpoint file " + fileName);
+    }
+    in.seekg(0, ios::end);
+    fileSize = in.tellg();
+    in.seekg(0, ios::beg);
+    CheckpointHeader header;
+    getBytes(&header, sizeof(header));
+    if (header.magic != CHECKPOINT_MAGIC || header.version != CHECKPOINT_VERSION ||
+        header.kind > CHECKPOINT_CYCLE) {
+        throw invalid_argument(fileName + " is not a checkpoint of this simulator version");
+    }
+    return static_cast<CheckpointKind>(header.kind);
+}
+
+void CheckpointReader::getBytes(void* data, uint64_t size) {
+    in.read(reinterpret_cast<char*>(data), size);
+    if (static_cast<uint64_t>(in.gcount()) != size) {
+        throw invalid_argument("Checkpoint file " + fileName + " is truncated");
+    }
+}
+
+string CheckpointReader::getString() {
+    // check the length first so that a corrupt one is not allocated
+    uint64_t length = get<uint64_t>();
+    if (length > fileSize - static_cast<uint64_t>(in.tellg())) {
+        throw invalid_argument("Checkpoint file " + fileName + " is truncated");
+    }
+    string text(length, '\0');
+    getBytes(&text[0], text.size());
+    return text;
+}
+
+Simulator::Instruction CheckpointReader::getInstruction() {
+    Simulator::Instruction inst;
+    inst.PC = get<uint64_t>();
+    inst.instruction = get<uint32_t>();
+    inst.opcode = get<uint8_t>();
+    inst.funct3 = get<uint8_t>();
+    inst.funct7 = get<uint8_t>();
+    inst.rd = get<uint8_t>();
+    inst.rs1 = get<uint8_t>();
+    inst.rs2 = get<uint8_t>();
+    uint16_t flags = get<uint16_t>();
+    inst.isHalt = flags & 1;
+    inst.isLegal = flags >> 1 & 1;
+    inst.isNop = flags >> 2 & 1;
+    inst.readsMem = flags >> 3 & 1;
+    inst.writesMem = flags >> 4 & 1;
+    inst.doesArithLogic = flags >> 5 & 1;
+    inst.writesRd = flags >> 6 & 1;
+    inst.readsRs1 = flags >> 7 & 1;
+    inst.readsRs2 = flags >> 8 & 1;
+    inst.memException = flags >> 9 & 1;
+    inst.isBubble = flags >> 10 & 1;
+    inst.status = static_cast<StageStatus>(get<uint8_t>());
+    inst.imm = get<uint64_t>();
+    inst.nextPC = get<uint64_t>();
+    inst.op1Val = get<uint64_t>();
+    inst.op2Val = get<uint64_t>();
+    inst.arithResult = get<uint64_t>();
+    inst.memAddress = get<uint64_t>();
+    inst.memResult = get<uint64_t>();
+    inst.instructionID = get<uint64_t>();
+    return inst;
+}
+
+void CheckpointReader::expectTag(uint32_t tag) {
+    if (get<uint32_t>() != tag) {
+        throw invalid_argument("Checkpoint file " + fileName + " is corrupt or of another kind");
+    }
+}
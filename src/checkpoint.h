@@ -0,0 +1,118 @@
+#pragma once
+#include <inttypes.h>
+
+#include <fstream>
+#include <string>
+#include <type_traits>
+
+#include "Utilities.h"
+#include "simulator.h"
+
+// A checkpoint file is a CheckpointHeader, the architectural state (PC,
+// dynamic instruction count, registers and the non-zero memory pages) and,
+// for the cycle simulator, the pipeline latches, counters and the state of
+// every cache. Values are stored in host (little-endian) byte order, and
+// every part starts with a four-byte tag so that a mismatched or truncated
+// file is caught instead of misread.
+#define CHECKPOINT_MAGIC 0x4b435652  // "RVCK"
+#define CHECKPOINT_VERSION 2
+
+enum CheckpointKind : uint32_t {
+    CHECKPOINT_FUNCT = 0,  // architectural state only, from sim_funct
+    CHECKPOINT_CYCLE,      // plus the pipeline and caches, from sim_cycle
+};
+
+struct CheckpointHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t kind;
+    uint32_t reserved;
+};
+
+// Tags of the parts of a checkpoint
+#define CHECKPOINT_TAG_ARCH 0x48435241   // "ARCH"
+#define CHECKPOINT_TAG_MEMORY 0x534d454d // "MEMS"
+#define CHECKPOINT_TAG_PIPE 0x45504950   // "PIPE"
+#define CHECKPOINT_TAG_CACHE 0x48434143  // "CACH"
+
+// When to write checkpoints and which one to resume from, as given by the
+// --checkpoint-at=N, --checkpoint-every=N and --restore=FILE options. N
+// counts cycles in sim_cycle and instructions in sim_funct.
+struct CheckpointOptions {
+    uint64_t at = 0;     // one checkpoint at this count, 0 for none
+    uint64_t every = 0;  // a checkpoint every this many, 0 for none
+    std::string restoreFile;
+
+    bool enabled() const { return at != 0 || every != 0; }
+
+    // the count of the first checkpoint after now, 0 if there is none
+    uint64_t next(uint64_t now) const;
+
+    // take arg if it is one of the checkpoint options, throws
+    // std::invalid_argument for a bad value
+    bool parse(const std::string& arg);
+};
+
+// name of the checkpoint taken at count, <base>_<count>.ckpt
+inline std::string checkpointFileName(const std::string& base_output_name, uint64_t count) {
+    return base_output_name + "_" + std::to_string(count) + ".ckpt";
+}
+
+class CheckpointWriter {
+   private:
+    std::ofstream out;
+
+   public:
+    // create fileName and write the header
+    Status open(const std::string& fileName, CheckpointKind kind);
+
+    template <typename T>
+    void put(T value) {
+        static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value,
+                      "checkpoint values are numbers");
+        out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void putBytes(const void* data, uint64_t size) {
+        out.write(reinterpret_cast<const char*>(data), size);
+    }
+
+    void putString(const std::string& text) {
+        put<uint64_t>(text.size());
+        putBytes(text.data(), text.size());
+    }
+
+    void putInstruction(const Simulator::Instruction& inst);
+
+    // flush the file, ERROR if any write failed
+    Status close();
+};
+
+// Reads what a CheckpointWriter wrote. Reading past the end of the file or
+// a missing tag throws std::invalid_argument.
+class CheckpointReader {
+   private:
+    std::ifstream in;
+    std::string fileName;
+    uint64_t fileSize = 0;
+
+   public:
+    // open fileName and check its header, throws std::invalid_argument
+    CheckpointKind open(const std::string& fileName);
+
+    template <typename T>
+    T get() {
+        static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value,
+                      "checkpoint values are numbers");
+        T value;
+        getBytes(&value, sizeof(value));
+        return value;
+    }
+
+    void getBytes(void* data, uint64_t size);
+    std::string getString();
+    Simulator::Instruction getInstruction();
+
+    // check that the next part of the file starts with tag
+    void expectTag(uint32_t tag);
+};
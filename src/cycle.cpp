@@ -1,54 +1,151 @@
 #include "cycle.h"
 
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <memory>
+#include <stdexcept>
 #include <string>
 
 #include "Utilities.h"
 #include "cache.h"
+#include "checkpoint.h"
 #include "simulator.h"
 
-static Simulator* simulator = nullptr;
-static Cache* iCache = nullptr;
-static Cache* dCache = nullptr;
-static std::string output;
-static uint64_t cycleCount = 0;
-
-static uint64_t PC = 0;
+// Every exception traps to this handler address
+#define EXCEPTION_HANDLER_ADDR 0x8000
 
 /**TODO: Implement pipeline simulation for the RISCV machine in this file.
  * A basic template is provided below that doesn't account for any hazards.
  */
 
-Simulator::Instruction doneInst;
-
 Simulator::Instruction nop(StageStatus status) {
     Simulator::Instruction nop;
     nop.instruction = 0x00000013;
     nop.isLegal = true;
     nop.isNop = true;
+    nop.isBubble = true;
     nop.status = status;
     return nop;
 }
 
-static struct PipelineInfo {
-    Simulator::Instruction ifInst = nop(IDLE);
-    Simulator::Instruction idInst = nop(IDLE);
-    Simulator::Instruction exInst = nop(IDLE);
-    Simulator::Instruction memInst = nop(IDLE);
-    Simulator::Instruction wbInst = nop(IDLE);
-} pipelineInfo;
+bool CycleSimulator::accessICache(uint64_t address) {
+    if (iStreamRecord) {
+        iStreamRecord->push_back(address);
+    }
+    return iCache->access(address, CACHE_READ);
+}
+
+bool CycleSimulator::accessDCache(uint64_t address, CacheOperation op) {
+    if (dStreamRecord) {
+        dStreamRecord->push_back(address);
+    }
+    return dCache->access(address, op);
+}
 
+// Fetch the instruction at PC into IF, starting an I-cache miss if needed
+void CycleSimulator::fetch() {
+    simulator->simIF(PC, pipelineInfo.ifInst);
+    pipelineInfo.ifInst.status = NORMAL;
+    if (!accessICache(PC)) {
+        ifMissCycles = iCache->getLastPenalty();
+    }
+    PC = PC + 4;
+}
 
 // initialize the simulator
-Status initSimulator(CacheConfig& iCacheConfig, CacheConfig& dCacheConfig, MemoryStore* mem,
-                     const std::string& output_name) {
-    output = output_name;
-    simulator = new Simulator();
-    simulator->setMemory(mem);
-    iCache = new Cache(iCacheConfig, I_CACHE);
-    dCache = new Cache(dCacheConfig, D_CACHE);
+Status CycleSimulator::init(const CacheConfig& icConfig, const CacheConfig& dcConfig,
+                           MemoryStore* memory, const std::string& outputName) {
+    release();
+    output = outputName;
+    try {
+        iCache.reset(new Cache(icConfig, I_CACHE));
+        dCache.reset(new Cache(dcConfig, D_CACHE));
+        for (const CacheConfig& config : lowerLevelConfigs) {
+            lowerLevels.emplace_back(new Cache(config, UNIFIED_CACHE));
+        }
+        if (!lowerLevels.empty()) {
+            iCache->setNextLevel(lowerLevels[0].get());
+            dCache->setNextLevel(lowerLevels[0].get());
+        }
+        for (size_t level = 1; level < lowerLevels.size(); level++) {
+            lowerLevels[level - 1]->setNextLevel(lowerLevels[level].get());
+        }
+    } catch (const std::invalid_argument& e) {
+        std::cerr << LOG_ERROR << e.what() << std::endl;
+        // The simulator owns the memory even if it cannot run
+        simulator.reset(new Simulator());
+        simulator->setMemory(memory);
+        return ERROR;
+    }
+    return reset(memory);
+}
+
+Status CycleSimulator::reset(MemoryStore* memory) {
+    pipeTrace.close();
+    simulator.reset(new Simulator());
+    simulator->setMemory(memory);
+    if (!iCache || !dCache) {
+        std::cerr << LOG_ERROR << "reset() needs the caches of an init()" << std::endl;
+        return ERROR;
+    }
+    iCache->reset();
+    dCache->reset();
+    for (const std::unique_ptr<Cache>& level : lowerLevels) {
+        level->reset();
+    }
+
+    cycleCount = 0;
+    PC = 0;
+    fastForwarded = 0;
+    pipelineInfo.ifInst = nop(IDLE);
+    pipelineInfo.idInst = nop(IDLE);
+    pipelineInfo.exInst = nop(IDLE);
+    pipelineInfo.memInst = nop(IDLE);
+    pipelineInfo.wbInst = nop(IDLE);
     doneInst = nop(IDLE);
+    ifMissCycles = 0;
+    memMissCycles = 0;
+    perf = PerfCounters();
+    loadBranchInEX = false;
+    if (pipeTraceConfig.enabled()) {
+        return pipeTrace.open(output, pipeTraceConfig.format);
+    }
+    return SUCCESS;
+}
+
+Status CycleSimulator::fastForward(uint64_t instructions, bool warmCaches) {
+    if (!simulator || !iCache || !dCache) {
+        std::cerr << LOG_ERROR << "fastForward() needs the caches of an init()" << std::endl;
+        return ERROR;
+    }
+    if (cycleCount != 0) {
+        std::cerr << LOG_ERROR << "Cannot fast-forward once the pipeline has started" << std::endl;
+        return ERROR;
+    }
+    uint64_t count = 0;
+    for (; count < instructions; count++) {
+        Simulator::Instruction inst;
+        if (!simulator->simInstructionUnlessTrap(PC, inst)) {
+            break;
+        }
+        // Straight to the caches, the stream recording is of the pipeline
+        if (warmCaches) {
+            iCache->access(PC, CACHE_READ);
+            if (inst.readsMem || inst.writesMem) {
+                dCache->access(inst.memAddress, inst.writesMem ? CACHE_WRITE : CACHE_READ);
+            }
+        }
+        PC = inst.nextPC;
+    }
+    fastForwarded += count;
+    if (warmCaches) {
+        iCache->resetCounters();
+        dCache->resetCounters();
+        for (const std::unique_ptr<Cache>& level : lowerLevels) {
+            level->resetCounters();
+        }
+    }
     return SUCCESS;
 }
 
@@ -60,7 +157,7 @@ bool hazard(const Simulator::Instruction& dstInst, uint64_t srcReg) {
 // return SUCCESS if reaching desired cycles.
 // return HALT if the simulator halts on 0xfeedfeed
 
-Status runCycles(uint64_t cycles) {
+Status CycleSimulator::runCycles(uint64_t cycles) {
     uint64_t count = 0;
     auto status = SUCCESS;
     PipeState pipeState = {
@@ -73,39 +170,100 @@ Status runCycles(uint64_t cycles) {
         pipeState.cycle = cycleCount;
         count++;
         cycleCount++;
+        perf.cycles++;
+
+        // Memory serves I-cache and D-cache misses at the same time, so the
+        // fetch miss counts down even while a D-cache miss holds the pipeline
+        bool fetchPending = ifMissCycles > 0;
+        if (fetchPending) {
+            ifMissCycles--;
+            perf.iCacheStallCycles++;
+        }
+
+        // A D-cache miss holds MEM and everything behind it, WB drains
+        if (memMissCycles > 0) {
+            memMissCycles--;
+            perf.dCacheStallCycles++;
+            pipelineInfo.wbInst = nop(BUBBLE);
+            continue;
+        }
 
-        Simulator::Instruction ID = pipelineInfo.idInst;
-        Simulator::Instruction EX = pipelineInfo.exInst;
+        // Hazard checks look at the latches before any stage updates them
+        const Simulator::Instruction& ID = pipelineInfo.idInst;
+        const Simulator::Instruction& EX = pipelineInfo.exInst;
 
         bool stall = false;
+        bool loadUseStall = false;
+        bool arithBranchStall = false;
+        bool loadBranchStall = false;
         bool flush = false;
         bool branchStall = false;
+        uint64_t fallThroughPC = PC;
+
+        // An instruction that faulted in MEM last cycle, or an illegal one in
+        // ID, is squashed along with everything behind it, and IF fetches
+        // from the exception handler this cycle
+        bool memFault = pipelineInfo.memInst.memException;
+        bool idFault = !memFault && !ID.isLegal;
+        bool exception = memFault || idFault;
+
+        bool idIsBranch = ID.opcode == OP_BRANCH || ID.opcode == OP_JALR;
+        bool continuesLoadBranch = loadBranchInEX;
+        loadBranchInEX = false;
 
         // Check load-use stalls
         if (EX.readsMem && EX.rd != 0) {
             if (EX.rd == ID.rs1 || EX.rd == ID.rs2) {
-            stall = true;
+                if (idIsBranch) {
+                    loadBranchStall = true;
+                } else {
+                    loadUseStall = true;
+                }
             }
         }
 
         // Check arithmetic-branch stall
-        if (EX.writesRd && (ID.opcode == OP_BRANCH || ID.opcode == OP_JALR) && EX.rd != 0) {
+        if (EX.writesRd && idIsBranch && EX.rd != 0) {
             if (ID.rs1 == EX.rd || ID.rs2 == EX.rd) {
-                stall = true;
+                arithBranchStall = !loadBranchStall;
             }
         }
 
         // load-branch stall number 2
-        if (pipelineInfo.memInst.readsMem && pipelineInfo.memInst.writesRd && (ID.opcode == OP_BRANCH || ID.opcode == OP_JALR) && pipelineInfo.memInst.rd != 0) {
+        bool memLoadBranch = false;
+        if (pipelineInfo.memInst.readsMem && pipelineInfo.memInst.writesRd && idIsBranch && pipelineInfo.memInst.rd != 0) {
             if (pipelineInfo.memInst.rd == ID.rs1 || pipelineInfo.memInst.rd == ID.rs2) {
-            stall = true;
+                memLoadBranch = true;
+            }
+        }
+
+        stall = loadUseStall || arithBranchStall || loadBranchStall || memLoadBranch;
+        if (exception) {
+            stall = false;
+            // Words fetched past the halt trap too, but never take effect
+            if (!EX.isHalt && !pipelineInfo.memInst.isHalt) {
+                perf.exceptionFlushes++;
             }
+        } else if (stall) {
+            perf.stallCycles++;
+            perf.loadUseStalls += loadUseStall;
+            perf.arithBranchStalls += arithBranchStall;
+            perf.loadBranchStalls += loadBranchStall + (memLoadBranch && !continuesLoadBranch);
+            loadBranchInEX = loadBranchStall;
         }
 
         // TAKE CARE OF WB
-        pipelineInfo.wbInst = simulator->simWB(pipelineInfo.memInst);
-        pipelineInfo.wbInst.status = NORMAL; // Not sure yet whether this is correct
+        if (memFault) {
+            pipelineInfo.wbInst = nop(SQUASHED);
+        } else {
+            pipelineInfo.wbInst = pipelineInfo.memInst;
+            simulator->simWB(pipelineInfo.wbInst);
+            pipelineInfo.wbInst.status = NORMAL; // Not sure yet whether this is correct
+        }
 
+        if (!pipelineInfo.wbInst.isBubble) {
+            perf.retiredInstructions++;
+        }
         if (pipelineInfo.wbInst.isHalt) {
             status = HALT;
         }
@@ -119,8 +277,22 @@ Status runCycles(uint64_t cycles) {
             }
         }
 
-        pipelineInfo.memInst = simulator->simMEM(pipelineInfo.exInst);
-        if (pipelineInfo.memInst.isHalt || pipelineInfo.memInst.isNop) {
+        if (memFault) {
+            pipelineInfo.memInst = nop(SQUASHED);
+        } else {
+            pipelineInfo.memInst = pipelineInfo.exInst;
+            simulator->simMEM(pipelineInfo.memInst);
+        }
+        if ((pipelineInfo.memInst.readsMem || pipelineInfo.memInst.writesMem) &&
+            !pipelineInfo.memInst.memException) {
+            CacheOperation op = pipelineInfo.memInst.writesMem ? CACHE_WRITE : CACHE_READ;
+            if (!accessDCache(pipelineInfo.memInst.memAddress, op)) {
+                memMissCycles = dCache->getLastPenalty();
+            }
+        }
+        if (memFault) {
+            // Keep the squashed status
+        } else if (pipelineInfo.memInst.isHalt || pipelineInfo.memInst.isNop) {
             pipelineInfo.memInst.status = BUBBLE;
         } else {
             pipelineInfo.memInst.status = NORMAL;
@@ -128,7 +300,9 @@ Status runCycles(uint64_t cycles) {
 
         // Take care of EX
         // Now we have to start worrying about stalls
-        if (stall) {
+        if (exception) {
+            pipelineInfo.exInst = nop(SQUASHED);
+        } else if (stall) {
             pipelineInfo.exInst = nop(BUBBLE);
         } else {
             // Take care of forwarding to the stage about to run EX
@@ -174,7 +348,8 @@ Status runCycles(uint64_t cycles) {
                 }
             }
 
-            pipelineInfo.exInst = simulator->simEX(pipelineInfo.idInst);
+            pipelineInfo.exInst = pipelineInfo.idInst;
+            simulator->simEX(pipelineInfo.exInst);
             if (pipelineInfo.exInst.isNop || pipelineInfo.exInst.isHalt) {
                 pipelineInfo.exInst.status = BUBBLE;
             } else {
@@ -183,27 +358,47 @@ Status runCycles(uint64_t cycles) {
         }
 
         // Take care of ID
-        if (stall) {
+        if (exception) {
+            pipelineInfo.idInst = nop(SQUASHED);
+        } else if (stall) {
             // Don't put a bubble here, hold the instruction
+        } else if (fetchPending) {
+            // IF is still waiting on an I-cache miss
+            pipelineInfo.idInst = nop(BUBBLE);
         } else {
-            Simulator::Instruction newIDInst = simulator->simID(pipelineInfo.ifInst); 
+            Simulator::Instruction newIDInst = pipelineInfo.ifInst;
+            simulator->simID(newIDInst);
+            // A decoded NOP may come from the decode cache, keep the bubble
+            newIDInst.isBubble = pipelineInfo.ifInst.isBubble;
             // Take care of branch forwarding
             // Need to make sure to delay if needed branch values are not ready yet
-            if (newIDInst.opcode == OP_BRANCH || newIDInst.opcode == OP_JALR) {
+            bool isBranch = newIDInst.isLegal &&
+                            (newIDInst.opcode == OP_BRANCH || newIDInst.opcode == OP_JALR);
+            if (isBranch) {
                 if (hazard(pipelineInfo.exInst, newIDInst.rs1) || hazard(pipelineInfo.exInst, newIDInst.rs2)) {
                     branchStall = true;
+                    if (pipelineInfo.exInst.readsMem) {
+                        perf.loadBranchStalls++;
+                        loadBranchInEX = true;
+                    } else {
+                        perf.arithBranchStalls++;
+                    }
                 }
                 if (hazard(pipelineInfo.memInst, newIDInst.rs1) || hazard(pipelineInfo.memInst, newIDInst.rs2)) {
                     if (pipelineInfo.memInst.readsMem) {
                         branchStall = true;
+                        perf.loadBranchStalls += !continuesLoadBranch;
                     }
                 }
+                if (branchStall) {
+                    perf.stallCycles++;
+                }
             }
 
             if (branchStall) {
                 pipelineInfo.idInst = nop(BUBBLE);
             } else {
-                if (newIDInst.opcode == OP_BRANCH || newIDInst.opcode == OP_JALR) {
+                if (isBranch) {
                     if (hazard(pipelineInfo.memInst, newIDInst.rs1)) {
                         if (pipelineInfo.memInst.readsMem) {
                             newIDInst.op1Val = pipelineInfo.memInst.memResult;
@@ -245,7 +440,7 @@ Status runCycles(uint64_t cycles) {
                         }
                     }
 
-                    newIDInst = simulator->simNextPCResolution(newIDInst);
+                    simulator->simNextPCResolution(newIDInst);
                 }
                 pipelineInfo.idInst = newIDInst;
                 if (pipelineInfo.idInst.isNop || pipelineInfo.idInst.isHalt) {
@@ -255,6 +450,7 @@ Status runCycles(uint64_t cycles) {
                 }
                  if (pipelineInfo.idInst.nextPC != pipelineInfo.ifInst.PC + 4) {
                     flush = true;
+                    perf.branchFlushes++;
                     PC = pipelineInfo.idInst.nextPC;
                 }
 
@@ -263,38 +459,49 @@ Status runCycles(uint64_t cycles) {
 
 
         // Take care of IF
-        if (stall || branchStall) {
+        if (exception) {
+            // Any outstanding fetch was on the squashed path
+            ifMissCycles = 0;
+            PC = EXCEPTION_HANDLER_ADDR;
+            fetch();
+        } else if (stall || branchStall || fetchPending) {
             // Hold instruction in IF
         } else if (flush) {
+            // The fall-through fetch of this cycle still reaches the I-cache
+            // before it is squashed, but its miss, if any, is abandoned
+            accessICache(fallThroughPC);
             pipelineInfo.ifInst = nop(BUBBLE);
         } else {
-            pipelineInfo.ifInst = simulator->simIF(PC);
-            pipelineInfo.ifInst.status = NORMAL;
-            PC = PC + 4;
+            fetch();
         }
         doneInst = pipelineInfo.wbInst;
         if (status == HALT) {
             break;
         }
     }
-    pipeState.ifPC = pipelineInfo.ifInst.PC;
-    pipeState.ifStatus = pipelineInfo.ifInst.status;
-    pipeState.idInstr = pipelineInfo.idInst.instruction;
-    pipeState.idStatus = pipelineInfo.idInst.status;
-    pipeState.exInstr = pipelineInfo.exInst.instruction;
-    pipeState.exStatus = pipelineInfo.exInst.status;
-    pipeState.memInstr = pipelineInfo.memInst.instruction;
-    pipeState.memStatus = pipelineInfo.memInst.status;
-    pipeState.wbInstr = pipelineInfo.wbInst.instruction;
-    pipeState.wbStatus = pipelineInfo.wbInst.status;
-
-    dumpPipeState(pipeState, output);
+    if (pipeTraceConfig.shouldTrace(pipeState.cycle)) {
+        pipeState.ifPC = pipelineInfo.ifInst.PC;
+        pipeState.ifStatus = pipelineInfo.ifInst.status;
+        pipeState.idInstr = pipelineInfo.idInst.instruction;
+        pipeState.idStatus = pipelineInfo.idInst.status;
+        pipeState.exInstr = pipelineInfo.exInst.instruction;
+        pipeState.exStatus = pipelineInfo.exInst.status;
+        pipeState.memInstr = pipelineInfo.memInst.instruction;
+        pipeState.memStatus = pipelineInfo.memInst.status;
+        pipeState.wbInstr = pipelineInfo.wbInst.instruction;
+        pipeState.wbStatus = pipelineInfo.wbInst.status;
+
+        pipeTrace.write(pipeState);
+    }
+    if (status == HALT) {
+        pipeTrace.flush();
+    }
 
     return status;
 }
 
 // run till halt
-Status runTillHalt() {
+Status CycleSimulator::runTillHalt() {
     Status status;
     while (true) {
         status = static_cast<Status>(runCycles(1));
@@ -303,15 +510,273 @@ Status runTillHalt() {
     return status;
 }
 
-// dump the state of the simulator
-Status finalizeSimulator() {
-    simulator->dumpRegMem(output);
+// A cycle at a time like runTillHalt(), so that the trace is the same
+Status CycleSimulator::runWithCheckpoints(const CheckpointOptions& checkpoints,
+                                          uint64_t maxCycles) {
+    Status status = SUCCESS;
+    for (uint64_t next = checkpoints.next(cycleCount);
+         next != 0 && (maxCycles == 0 || next <= maxCycles) && status == SUCCESS;
+         next = checkpoints.next(cycleCount)) {
+        while (cycleCount < next && status == SUCCESS) {
+            status = runCycles(1);
+        }
+        if (status == SUCCESS && saveCheckpoint(checkpointFileName(output, next)) != SUCCESS) {
+            return ERROR;
+        }
+    }
+    if (status == SUCCESS && maxCycles == 0) {
+        return runTillHalt();
+    }
+    while (status == SUCCESS && cycleCount < maxCycles) {
+        status = runCycles(1);
+    }
+    return status;
+}
+
+SimulationStats CycleSimulator::getSimulationStats() const {
     // Populate cache hit/miss statistics from the I/D caches
     uint64_t icHits = iCache ? iCache->getHits() : 0;
     uint64_t icMisses = iCache ? iCache->getMisses() : 0;
     uint64_t dcHits = dCache ? dCache->getHits() : 0;
     uint64_t dcMisses = dCache ? dCache->getMisses() : 0;
-    SimulationStats stats{simulator->getDin(),  cycleCount, icHits, icMisses, dcHits, dcMisses, 0};
-    dumpSimStats(stats, output);
+    // Load-use stalls include load-branch stalls, counted once per dependency
+    return SimulationStats{perf.retiredInstructions, cycleCount, icHits, icMisses,
+                           dcHits, dcMisses, perf.loadUseStalls + perf.loadBranchStalls};
+}
+
+// append the statistics of L2 and L3 to _sim_stats.out
+Status CycleSimulator::dumpLowerLevelStats() {
+    std::ofstream simStats(output + "_sim_stats.out", std::ios::app);
+    if (!simStats) {
+        std::cerr << LOG_ERROR << "Could not open sim stats file!" << std::endl;
+        return ERROR;
+    }
+    for (size_t level = 0; level < lowerLevels.size(); level++) {
+        std::string name = "L" + std::to_string(level + 2);
+        simStats << std::left << std::setw(23) << name + " hits: " << lowerLevels[level]->getHits() << std::endl;
+        simStats << std::left << std::setw(23) << name + " misses: " << lowerLevels[level]->getMisses() << std::endl;
+        simStats << std::left << std::setw(23) << name + " writebacks: " << lowerLevels[level]->getWritebacks() << std::endl;
+    }
+    return SUCCESS;
+}
+
+// append the performance counters to _sim_stats.out
+Status CycleSimulator::dumpPerfStats() {
+    std::ofstream simStats(output + "_sim_stats.out", std::ios::app);
+    if (!simStats) {
+        std::cerr << LOG_ERROR << "Could not open sim stats file!" << std::endl;
+        return ERROR;
+    }
+    simStats << std::left << std::setw(23) << "Arith-branch stalls: " << perf.arithBranchStalls << std::endl;
+    simStats << std::left << std::setw(23) << "Load-branch stalls: "  << perf.loadBranchStalls << std::endl;
+    simStats << std::left << std::setw(23) << "Stall cycles: "        << perf.stallCycles << std::endl;
+    simStats << std::left << std::setw(23) << "Branch flushes: "      << perf.branchFlushes << std::endl;
+    simStats << std::left << std::setw(23) << "Exception flushes: "   << perf.exceptionFlushes << std::endl;
+    simStats << std::left << std::setw(23) << "I-cache stall cycles: " << perf.iCacheStallCycles << std::endl;
+    simStats << std::left << std::setw(23) << "D-cache stall cycles: " << perf.dCacheStallCycles << std::endl;
+    simStats << std::left << std::setw(23) << "D-cache writebacks: "  << dCache->getWritebacks() << std::endl;
+    simStats << std::left << std::setw(23) << "D-cache writethroughs: " << dCache->getWriteThroughs() << std::endl;
+    if (fastForwarded != 0) {
+        simStats << std::left << std::setw(23) << "Fast-forwarded insts: " << fastForwarded << std::endl;
+    }
+    simStats << std::left << std::setw(23) << "CPI: " << std::fixed << std::setprecision(3)
+             << perf.cpi() << std::endl;
+    return SUCCESS;
+}
+
+// dump the state of the simulator
+Status CycleSimulator::finalize() {
+    pipeTrace.close();
+    simulator->dumpRegMem(output);
+    SimulationStats stats = getSimulationStats();
+    Status status = dumpSimStats(stats, output);
+    if (status == SUCCESS && !lowerLevels.empty()) {
+        status = dumpLowerLevelStats();
+    }
+    if (status == SUCCESS && perfStatsEnabled) {
+        status = dumpPerfStats();
+    }
+    return status;
+}
+
+void CycleSimulator::release() {
+    pipeTrace.close();
+    simulator.reset();
+    iCache.reset();
+    dCache.reset();
+    lowerLevels.clear();
+}
+
+Status CycleSimulator::saveCheckpoint(const std::string& fileName) const {
+    CheckpointWriter writer;
+    if (writer.open(fileName, CHECKPOINT_CYCLE) != SUCCESS) {
+        return ERROR;
+    }
+    writer.put(PC);
+    simulator->saveCheckpoint(writer);
+
+    writer.put<uint32_t>(CHECKPOINT_TAG_PIPE);
+    writer.put(cycleCount);
+    writer.put(ifMissCycles);
+    writer.put(memMissCycles);
+    writer.put<uint8_t>(loadBranchInEX);
+    for (uint64_t counter : {perf.cycles, perf.retiredInstructions, perf.loadUseStalls,
+                             perf.arithBranchStalls, perf.loadBranchStalls, perf.stallCycles,
+                             perf.branchFlushes, perf.exceptionFlushes, perf.iCacheStallCycles,
+                             perf.dCacheStallCycles}) {
+        writer.put(counter);
+    }
+    for (const Simulator::Instruction* inst :
+         {&pipelineInfo.ifInst, &pipelineInfo.idInst, &pipelineInfo.exInst,
+          &pipelineInfo.memInst, &pipelineInfo.wbInst, &doneInst}) {
+        writer.putInstruction(*inst);
+    }
+
+    writer.put<uint64_t>(2 + lowerLevels.size());
+    iCache->saveCheckpoint(writer);
+    dCache->saveCheckpoint(writer);
+    for (const std::unique_ptr<Cache>& level : lowerLevels) {
+        level->saveCheckpoint(writer);
+    }
+    return writer.close();
+}
+
+Status CycleSimulator::restoreCheckpoint(const std::string& fileName) {
+    if (!simulator || !iCache || !dCache) {
+        std::cerr << LOG_ERROR << "restoreCheckpoint() needs the caches of an init()" << std::endl;
+        return ERROR;
+    }
+    // Start from a clean pipeline and cold caches on the current memory,
+    // which the checkpoint then overwrites
+    MemoryStore* memory = simulator->getMemory();
+    simulator->setMemory(nullptr);
+    Status status = reset(memory);
+    if (status != SUCCESS) {
+        return status;
+    }
+
+    try {
+        CheckpointReader reader;
+        CheckpointKind kind = reader.open(fileName);
+        PC = reader.get<uint64_t>();
+        simulator->restoreCheckpoint(reader);
+        if (kind == CHECKPOINT_FUNCT) {
+            return SUCCESS;
+        }
+
+        reader.expectTag(CHECKPOINT_TAG_PIPE);
+        cycleCount = reader.get<uint64_t>();
+        ifMissCycles = reader.get<uint64_t>();
+        memMissCycles = reader.get<uint64_t>();
+        loadBranchInEX = reader.get<uint8_t>();
+        for (uint64_t* counter : {&perf.cycles, &perf.retiredInstructions, &perf.loadUseStalls,
+                                  &perf.arithBranchStalls, &perf.loadBranchStalls,
+                                  &perf.stallCycles, &perf.branchFlushes, &perf.exceptionFlushes,
+                                  &perf.iCacheStallCycles, &perf.dCacheStallCycles}) {
+            *counter = reader.get<uint64_t>();
+        }
+        for (Simulator::Instruction* inst :
+             {&pipelineInfo.ifInst, &pipelineInfo.idInst, &pipelineInfo.exInst,
+              &pipelineInfo.memInst, &pipelineInfo.wbInst, &doneInst}) {
+            *inst = reader.getInstruction();
+        }
+
+        if (reader.get<uint64_t>() != 2 + lowerLevels.size()) {
+            throw std::invalid_argument(
+                "The checkpoint was taken with another number of cache levels");
+        }
+        iCache->restoreCheckpoint(reader);
+        dCache->restoreCheckpoint(reader);
+        for (const std::unique_ptr<Cache>& level : lowerLevels) {
+            level->restoreCheckpoint(reader);
+        }
+    } catch (const std::invalid_argument& e) {
+        std::cerr << LOG_ERROR << e.what() << std::endl;
+        return ERROR;
+    }
     return SUCCESS;
 }
+
+// The simulator behind the free functions, one per thread
+static CycleSimulator& defaultSimulator() {
+    static thread_local CycleSimulator instance;
+    return instance;
+}
+
+Status initSimulator(CacheConfig& iCacheConfig, CacheConfig& dCacheConfig, MemoryStore* mem,
+                     const std::string& output_name) {
+    return defaultSimulator().init(iCacheConfig, dCacheConfig, mem, output_name);
+}
+
+void setPipeTraceConfig(const PipeTraceConfig& config) {
+    defaultSimulator().setPipeTraceConfig(config);
+}
+
+void setCacheStreamRecording(std::vector<uint64_t>* iStream, std::vector<uint64_t>* dStream) {
+    defaultSimulator().setCacheStreamRecording(iStream, dStream);
+}
+
+void setLowerCacheLevels(const std::vector<CacheConfig>& configs) {
+    defaultSimulator().setLowerCacheLevels(configs);
+}
+
+uint64_t getCycleCount() {
+    return defaultSimulator().getCycleCount();
+}
+
+Status fastForward(uint64_t instructions, bool warmCaches) {
+    return defaultSimulator().fastForward(instructions, warmCaches);
+}
+
+uint64_t getFastForwardedInstructions() {
+    return defaultSimulator().getFastForwardedInstructions();
+}
+
+const PerfCounters& getPerfCounters() {
+    return defaultSimulator().getPerfCounters();
+}
+
+void setPerfStatsEnabled(bool enabled) {
+    defaultSimulator().setPerfStatsEnabled(enabled);
+}
+
+Status runCycles(uint64_t cycles) {
+    return defaultSimulator().runCycles(cycles);
+}
+
+Status runTillHalt() {
+    return defaultSimulator().runTillHalt();
+}
+
+Status runWithCheckpoints(const CheckpointOptions& checkpoints, uint64_t maxCycles) {
+    return defaultSimulator().runWithCheckpoints(checkpoints, maxCycles);
+}
+
+SimulationStats getSimulationStats() {
+    return defaultSimulator().getSimulationStats();
+}
+
+Status finalizeSimulator() {
+    return defaultSimulator().finalize();
+}
+
+void releaseSimulator() {
+    defaultSimulator().release();
+}
+
+Status saveCheckpoint(const std::string& fileName) {
+    return defaultSimulator().saveCheckpoint(fileName);
+}
+
+Status restoreCheckpoint(const std::string& fileName) {
+    return defaultSimulator().restoreCheckpoint(fileName);
+}
+
+Status restoreSimulator(CacheConfig& iCacheConfig, CacheConfig& dCacheConfig, MemoryStore* mem,
+                        const std::string& fileName, const std::string& output_name) {
+    Status status = defaultSimulator().init(iCacheConfig, dCacheConfig, mem, output_name);
+    if (status != SUCCESS) {
+        return status;
+    }
+    return defaultSimulator().restoreCheckpoint(fileName);
+}
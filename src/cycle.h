@@ -1,19 +1,249 @@
 #pragma once
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "cache.h"
 #include "Utilities.h"
 #include "simulator.h"
 
+struct CheckpointOptions;
+
+// Performance counters of the pipeline, updated every cycle by runCycles().
+// Stalls count events, except where noted as cycles. I-cache and D-cache
+// stall cycles can overlap because memory serves both misses at once.
+struct PerfCounters {
+    uint64_t cycles = 0;
+    uint64_t retiredInstructions = 0;  // reached WB, including the halt
+    uint64_t loadUseStalls = 0;        // one cycle each
+    uint64_t arithBranchStalls = 0;    // one cycle each
+    uint64_t loadBranchStalls = 0;     // one or two cycles each
+    uint64_t stallCycles = 0;          // cycles lost to all of the stalls above
+    uint64_t branchFlushes = 0;        // taken branches and jumps resolved in ID
+    uint64_t exceptionFlushes = 0;     // illegal instructions and memory faults
+    uint64_t iCacheStallCycles = 0;    // cycles IF waited on an I-cache miss
+    uint64_t dCacheStallCycles = 0;    // cycles the pipeline froze on a D-cache miss
+
+    double cpi() const {
+        return retiredInstructions ? static_cast<double>(cycles) / retiredInstructions : 0.0;
+    }
+};
+
+// One cycle-accurate simulation of the five-stage pipeline: its latches,
+// caches, counters and pipe state trace. Instances share no state, so any
+// number of them can run in one process, on one thread or on many.
+class CycleSimulator {
+   public:
+    CycleSimulator() = default;
+    CycleSimulator(const CycleSimulator&) = delete;
+    CycleSimulator& operator=(const CycleSimulator&) = delete;
+
+    // select which cycles go to the pipe state trace (every cycle by default),
+    // takes effect at the next init() or reset()
+    void setPipeTraceConfig(const PipeTraceConfig& config) { pipeTraceConfig = config; }
+
+    // shared cache levels behind the L1 I/D caches, L2 first (none by
+    // default), takes effect at the next init()
+    void setLowerCacheLevels(const std::vector<CacheConfig>& configs) {
+        lowerLevelConfigs = configs;
+    }
+
+    // append every address sent to the I-cache/D-cache to these vectors from
+    // now on, nullptr stops recording
+    void setCacheStreamRecording(std::vector<uint64_t>* iStream, std::vector<uint64_t>* dStream) {
+        iStreamRecord = iStream;
+        dStreamRecord = dStream;
+    }
+
+    // also write the performance counters to _sim_stats.out, call before
+    // finalize()
+    void setPerfStatsEnabled(bool enabled) { perfStatsEnabled = enabled; }
+
+    /** Build the caches and start a run
+     * @return ERROR, with a message on cerr, for a bad cache configuration
+     * @param
+     *      icConfig, dcConfig: the L1 caches
+     *      memory: program image, owned by the simulator from now on
+     *      outputName: base name of the output files
+     */
+    Status init(const CacheConfig& icConfig, const CacheConfig& dcConfig, MemoryStore* memory,
+                const std::string& outputName);
+
+    // Start over on memory (a fresh clone of the image, say) with the caches
+    // of the last init(), which are emptied in place rather than rebuilt
+    Status reset(MemoryStore* memory);
+
+    /** Run up to instructions instructions on the functional path before the
+     * pipeline starts, which then fetches from where it stopped. It stops
+     * early before the halt or an instruction that traps, and leaves those to
+     * the pipeline. Warming sends the address of every instruction to the
+     * I-cache and every load and store to the D-cache, and then zeroes the
+     * cache counters, so the statistics only cover the detailed run.
+     * @return ERROR, with a message on cerr, once the pipeline has started
+     */
+    Status fastForward(uint64_t instructions, bool warmCaches);
+
+    // run for a number of cycles, 0 runs till halt; only the state after
+    // the last cycle goes to the pipe state trace
+    // return SUCCESS if reaching desired cycles.
+    // return HALT if the simulator halts on 0xfeedfeed
+    Status runCycles(uint64_t cycles);
+
+    // run till halt, tracing every cycle
+    Status runTillHalt();
+
+    /** Run like runTillHalt(), writing the checkpoints that checkpoints asks
+     * for to <output name>_<cycle>.ckpt on the way
+     * @return HALT, SUCCESS once maxCycles cycles are done (0: no limit), or
+     *         ERROR if a checkpoint could not be written
+     */
+    Status runWithCheckpoints(const CheckpointOptions& checkpoints, uint64_t maxCycles);
+
+    // dump the registers, memory and statistics
+    Status finalize();
+
+    // free the simulator, its memory and its caches
+    void release();
+
+    // Write the whole machine state to a checkpoint file: the registers,
+    // memory, pipeline latches, counters and the state of every cache
+    Status saveCheckpoint(const std::string& fileName) const;
+
+    /** Continue from a checkpoint, after an init() with the caches it was
+     * taken with. A sim_funct checkpoint only holds the architectural state:
+     * the run then starts at its PC at cycle 0, with an empty pipeline and
+     * cold caches, and counts only the instructions from there on.
+     * @return ERROR, with a message on cerr, for an unreadable checkpoint or
+     *         one taken with other caches
+     */
+    Status restoreCheckpoint(const std::string& fileName);
+
+    // number of cycles simulated so far
+    uint64_t getCycleCount() const { return cycleCount; }
+
+    // instructions run by fastForward() since the last init() or reset()
+    uint64_t getFastForwardedInstructions() const { return fastForwarded; }
+
+    // counters of the current run, reset by init() and reset()
+    const PerfCounters& getPerfCounters() const { return perf; }
+
+    // statistics of the current run, as finalize() writes them
+    SimulationStats getSimulationStats() const;
+
+   private:
+    // Pipeline latches, each stage updates its own in place
+    struct alignas(64) PipelineInfo {
+        Simulator::Instruction ifInst;
+        Simulator::Instruction idInst;
+        Simulator::Instruction exInst;
+        Simulator::Instruction memInst;
+        Simulator::Instruction wbInst;
+    };
+
+    PipelineInfo pipelineInfo;
+    // The instruction that left WB last cycle, still forwarded from
+    Simulator::Instruction doneInst;
+
+    std::unique_ptr<Simulator> simulator;
+    std::unique_ptr<Cache> iCache;
+    std::unique_ptr<Cache> dCache;
+    std::vector<std::unique_ptr<Cache>> lowerLevels;  // L2 first
+    std::vector<CacheConfig> lowerLevelConfigs;
+
+    uint64_t cycleCount = 0;
+    uint64_t PC = 0;
+    uint64_t fastForwarded = 0;
+
+    // Cycles left until the outstanding I-cache/D-cache miss is served
+    uint64_t ifMissCycles = 0;
+    uint64_t memMissCycles = 0;
+
+    PerfCounters perf;
+    bool perfStatsEnabled = false;
+
+    // The last cycle stalled a branch on a load in EX. The load moves on to MEM
+    // and stalls the branch once more, which belongs to the same load-branch stall.
+    bool loadBranchInEX = false;
+
+    // When set, every address the pipeline sends to the I-cache/D-cache is
+    // appended here, see setCacheStreamRecording()
+    std::vector<uint64_t>* iStreamRecord = nullptr;
+    std::vector<uint64_t>* dStreamRecord = nullptr;
+
+    // Pipe state trace, opened by init() and reset()
+    std::string output;
+    PipeTraceWriter pipeTrace;
+    PipeTraceConfig pipeTraceConfig;
+
+    bool accessICache(uint64_t address);
+    bool accessDCache(uint64_t address, CacheOperation op);
+    void fetch();
+    Status dumpLowerLevelStats();
+    Status dumpPerfStats();
+};
+
+// The functions below drive a default CycleSimulator, one per thread.
+
 // init the simulator and all info
 Status initSimulator(CacheConfig& icConfig, CacheConfig& dcConfig, MemoryStore* memory,
                      const std::string& output_name);
 
+// select which cycles go to the pipe state trace (every cycle by default),
+// must be called before initSimulator()
+void setPipeTraceConfig(const PipeTraceConfig& config);
+
+// shared cache levels behind the L1 I/D caches, L2 first (none by default),
+// must be called before initSimulator()
+void setLowerCacheLevels(const std::vector<CacheConfig>& configs);
+
+// append every address sent to the I-cache/D-cache to these vectors from now
+// on, nullptr stops recording
+void setCacheStreamRecording(std::vector<uint64_t>* iStream, std::vector<uint64_t>* dStream);
+
+// number of cycles simulated so far
+uint64_t getCycleCount();
+
+// counters of the current run, reset by initSimulator()
+const PerfCounters& getPerfCounters();
+
+// also write the performance counters to _sim_stats.out, call before
+// finalizeSimulator()
+void setPerfStatsEnabled(bool enabled);
+
+// run instructions functionally before the first cycle, see
+// CycleSimulator::fastForward()
+Status fastForward(uint64_t instructions, bool warmCaches);
+
+// number of instructions run by fastForward()
+uint64_t getFastForwardedInstructions();
+
 // run the simulator for a certain number of cycles
 Status runCycles(uint64_t cycles);
 
 // run till halt
 Status runTillHalt();
 
+// run till halt or maxCycles (0: no limit), writing checkpoints on the way,
+// see CycleSimulator::runWithCheckpoints()
+Status runWithCheckpoints(const CheckpointOptions& checkpoints, uint64_t maxCycles);
+
+// statistics of the current run, as finalizeSimulator() writes them
+SimulationStats getSimulationStats();
+
 // dump the state of the simulator
-Status finalizeSimulator();
\ No newline at end of file
+Status finalizeSimulator();
+
+// write the state of the simulator to a checkpoint file
+Status saveCheckpoint(const std::string& fileName);
+
+// continue from a checkpoint file, call after initSimulator()
+Status restoreCheckpoint(const std::string& fileName);
+
+// init the simulator from a checkpoint file instead of a program, in place of
+// initSimulator(); the checkpoint replaces the contents of memory
+Status restoreSimulator(CacheConfig& icConfig, CacheConfig& dcConfig, MemoryStore* memory,
+                        const std::string& fileName, const std::string& output_name);
+
+// free the simulator, its memory and its caches; initSimulator() also frees
+// those of the previous run
+void releaseSimulator();
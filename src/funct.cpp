@@ -1,12 +1,17 @@
 #include "funct.h"
 
 #include <iostream>
+#include <stdexcept>
 
 #include "cache.h"
+#include "checkpoint.h"
 #include "Utilities.h"
 #include "simulator.h"
+#include "translate.h"
 
 static Simulator* simulator = nullptr;
+static Translator* translator = nullptr;
+static bool translationEnabled = false;
 static std::string output;
 static uint64_t PC = 0;
 
@@ -15,13 +20,24 @@ Status initSimulator(MemoryStore* mem, const std::string& output_name) {
     output = output_name;
     simulator = new Simulator();
     simulator->setMemory(mem);
+    if (translationEnabled) {
+        translator = new Translator(simulator);
+    }
     return SUCCESS;
 }
 
+void setTranslationEnabled(bool enabled) {
+    translationEnabled = enabled;
+}
+
 // run the simulator for a certain number of intructions
 // return SUCCESS if count of executed instructions == desired intructions.
 // return HALT if the simulator halts on 0xfeedfeed
 Status runInstructions(uint64_t instructions) {
+    if (translator) {
+        return translator->run(PC, instructions);
+    }
+
     uint64_t numInstructions = 0;
     auto status = SUCCESS;
 
@@ -49,6 +65,11 @@ Status runInstructions(uint64_t instructions) {
 // status tells you to HALT or ERROR out
 Status runTillHalt() {
     Status status;
+    if (translator) {
+        // Translated blocks only pay off when they are not cut into single
+        // instructions, so run without a limit
+        return runInstructions(0);
+    }
     while (true) {
         status = static_cast<Status>(runInstructions(1));
         if (status == HALT || status == ERROR) break;
@@ -56,6 +77,21 @@ Status runTillHalt() {
     return status;
 }
 
+Status runWithCheckpoints(const CheckpointOptions& checkpoints) {
+    Status status = SUCCESS;
+    for (uint64_t next = checkpoints.next(simulator->getDin()); next != 0 && status == SUCCESS;
+         next = checkpoints.next(simulator->getDin())) {
+        status = runInstructions(next - simulator->getDin());
+        if (status == SUCCESS) {
+            status = saveCheckpoint(checkpointFileName(output, next));
+        }
+    }
+    if (status == SUCCESS) {
+        status = runTillHalt();
+    }
+    return status;
+}
+
 // dump the stats of the simulator
 Status finalizeSimulator() {
     simulator->dumpRegMem(output);
@@ -63,3 +99,41 @@ Status finalizeSimulator() {
     dumpSimStats(stats, output);
     return SUCCESS;
 }
+
+uint64_t getInstructionCount() {
+    return simulator->getDin();
+}
+
+Status saveCheckpoint(const std::string& fileName) {
+    CheckpointWriter writer;
+    if (writer.open(fileName, CHECKPOINT_FUNCT) != SUCCESS) {
+        return ERROR;
+    }
+    writer.put(PC);
+    simulator->saveCheckpoint(writer);
+    return writer.close();
+}
+
+Status restoreSimulator(const std::string& fileName, MemoryStore* mem,
+                        const std::string& output_name) {
+    output = output_name;
+    simulator = new Simulator();
+    simulator->setMemory(mem);
+    try {
+        CheckpointReader reader;
+        if (reader.open(fileName) != CHECKPOINT_FUNCT) {
+            // Its registers lag behind the instructions in flight
+            throw std::invalid_argument(fileName + " is a sim_cycle checkpoint, which only "
+                                                   "sim_cycle can resume");
+        }
+        PC = reader.get<uint64_t>();
+        simulator->restoreCheckpoint(reader);
+    } catch (const std::invalid_argument& e) {
+        std::cerr << LOG_ERROR << e.what() << std::endl;
+        return ERROR;
+    }
+    if (translationEnabled) {
+        translator = new Translator(simulator);
+    }
+    return SUCCESS;
+}
@@ -4,9 +4,15 @@
 #include "Utilities.h"
 #include "simulator.h"
 
+struct CheckpointOptions;
+
 // init the simulator and all info
 Status initSimulator(MemoryStore* memory, const std::string& output_name);
 
+// run through the translated execution engine instead of simInstruction(),
+// must be called before initSimulator()
+void setTranslationEnabled(bool enabled);
+
 // run the simulator for a certain number of instructions
 Status runInstructions(uint64_t instructions);
 
@@ -14,5 +20,20 @@ Status runInstructions(uint64_t instructions);
 // status tells you to HALT or ERROR out
 Status runTillHalt();
 
+// run till halt, writing the checkpoints that checkpoints asks for to
+// <output_name>_<instructions>.ckpt on the way
+Status runWithCheckpoints(const CheckpointOptions& checkpoints);
+
 // dump the state of the simulator
 Status finalizeSimulator();
+
+// instructions executed so far, counting those before a restored checkpoint
+uint64_t getInstructionCount();
+
+// write the PC, registers and memory to a checkpoint file
+Status saveCheckpoint(const std::string& fileName);
+
+// init the simulator from a checkpoint of sim_funct instead of a program, in
+// place of initSimulator(); the checkpoint replaces the contents of mem
+Status restoreSimulator(const std::string& fileName, MemoryStore* mem,
+                        const std::string& output_name);
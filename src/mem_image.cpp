@@ -0,0 +1,72 @@
+/** NOTE initial memory image converter
+ * Turns a text init_mem_image (hex address/word pairs) into the binary
+ * segment format that prepareMemory() loads with one bulk copy per segment.
+ * Words at consecutive addresses are merged into one segment.
+ */
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "MemoryStore.h"
+#include "Utilities.h"
+
+using namespace std;
+
+struct Segment {
+    uint64_t address;
+    vector<uint8_t> bytes;
+};
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        cerr << LOG_ERROR << "Usage: " << argv[0] << " <text init_mem_image> <binary output file>"
+             << endl;
+        return ERROR;
+    }
+
+    ifstream text_in(argv[1]);
+    if (!text_in) {
+        cerr << LOG_ERROR << "Unable to open memory image " << argv[1] << endl;
+        return ERROR;
+    }
+
+    // Segments are kept in file order so that later words still overwrite
+    // earlier ones at the same address
+    vector<Segment> segments;
+    uint32_t addr = 0;
+    uint32_t curVal = 0;
+    while (text_in >> hex >> addr >> hex >> curVal) {
+        if (segments.empty() ||
+            segments.back().address + segments.back().bytes.size() != addr) {
+            segments.push_back(Segment{addr, {}});
+        }
+        for (int i = 0; i < WORD_SIZE; i++) {
+            segments.back().bytes.push_back((curVal >> (i * 8)) & 0xFF);
+        }
+    }
+    if (!text_in.eof()) {
+        cerr << LOG_ERROR << "Could not parse " << argv[1] << endl;
+        return ERROR;
+    }
+
+    ofstream image_out(argv[2], ios::out | ios::binary);
+    if (!image_out) {
+        cerr << LOG_ERROR << "Could not open output file " << argv[2] << endl;
+        return ERROR;
+    }
+
+    MemImageHeader header{MEM_IMAGE_MAGIC, MEM_IMAGE_VERSION, segments.size()};
+    image_out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const Segment& segment : segments) {
+        MemImageSegment segmentHeader{segment.address, segment.bytes.size()};
+        image_out.write(reinterpret_cast<const char*>(&segmentHeader), sizeof(segmentHeader));
+        image_out.write(reinterpret_cast<const char*>(segment.bytes.data()), segment.bytes.size());
+    }
+
+    if (!image_out) {
+        cerr << LOG_ERROR << "Could not write " << argv[2] << endl;
+        return ERROR;
+    }
+    return SUCCESS;
+}
@@ -0,0 +1,94 @@
+/** NOTE binary pipe trace decoder
+ * Turns a _pipe_state.bin written by `sim_cycle --trace-format=binary` back
+ * into the text format of _pipe_state.out, optionally restricted to a
+ * window of cycles.
+ */
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "Utilities.h"
+
+using namespace std;
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        cerr << LOG_ERROR << "Usage: " << argv[0]
+             << " <file_pipe_state.bin> [--window=START:END] [-o <output file>]" << endl
+             << "Note:" << endl
+             << "Without -o, the output is written to the input name with a .out extension."
+             << endl;
+        return ERROR;
+    }
+
+    string inputFile = argv[1];
+    string outputFile = getBaseFilename(argv[1]) + ".out";
+    bool windowed = false;
+    uint64_t windowStart = 0;
+    uint64_t windowEnd = 0;
+
+    try {
+        for (int i = 2; i < argc; i++) {
+            string arg = argv[i];
+            if (arg == "-o" && i + 1 < argc) {
+                outputFile = argv[++i];
+            } else if (arg.compare(0, 9, "--window=") == 0) {
+                string window = arg.substr(9);
+                size_t colon = window.find(':');
+                if (colon == string::npos) {
+                    throw invalid_argument("--window expects <start>:<end>");
+                }
+                windowed = true;
+                windowStart = stoull(window.substr(0, colon));
+                windowEnd = stoull(window.substr(colon + 1));
+                if (windowStart > windowEnd) {
+                    throw invalid_argument("--window needs START <= END");
+                }
+            } else {
+                throw invalid_argument("Unknown option " + arg);
+            }
+        }
+    } catch (const invalid_argument& e) {
+        cerr << LOG_ERROR << e.what() << endl;
+        return ERROR;
+    } catch (const out_of_range& e) {
+        cerr << LOG_ERROR << "One of the integer arguments is out of range." << endl;
+        return ERROR;
+    }
+
+    ifstream trace_in(inputFile, ios::in | ios::binary);
+    if (!trace_in) {
+        cerr << LOG_ERROR << "Unable to open pipe trace " << inputFile << endl;
+        return ERROR;
+    }
+
+    PipeTraceHeader header;
+    if (!trace_in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        header.magic != PIPE_TRACE_MAGIC || header.version != PIPE_TRACE_VERSION ||
+        header.recordSize != sizeof(PipeTraceRecord)) {
+        cerr << LOG_ERROR << inputFile << " is not a version " << PIPE_TRACE_VERSION
+             << " binary pipe trace" << endl;
+        return ERROR;
+    }
+
+    ofstream pipe_out(outputFile);
+    if (!pipe_out) {
+        cerr << LOG_ERROR << "Could not open output file " << outputFile << endl;
+        return ERROR;
+    }
+
+    PipeTraceRecord record;
+    while (trace_in.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+        if (windowed && (record.cycle < windowStart || record.cycle > windowEnd)) {
+            continue;
+        }
+        printPipeState(unpackPipeState(record), pipe_out);
+    }
+
+    if (trace_in.gcount() != 0) {
+        cerr << LOG_ERROR << "Truncated record at the end of " << inputFile << endl;
+        return ERROR;
+    }
+    return SUCCESS;
+}
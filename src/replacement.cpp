@@ -0,0 +1,261 @@
+#include "replacement.h"
+
+#include <algorithm>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+#include "checkpoint.h"
+
+using namespace std;
+
+static const char* const REPLACEMENT_NAMES[] = {"lru", "plru", "fifo", "random",
+                                                "nru", "srrip", "brrip"};
+
+const char* replacementName(ReplacementKind kind) {
+    return REPLACEMENT_NAMES[kind];
+}
+
+ReplacementKind parseReplacementKind(const string& name) {
+    for (int kind = REPL_LRU; kind <= REPL_BRRIP; kind++) {
+        if (name == REPLACEMENT_NAMES[kind]) {
+            return static_cast<ReplacementKind>(kind);
+        }
+    }
+    throw invalid_argument("Unknown replacement policy " + name);
+}
+
+template <typename T>
+static void saveVector(CheckpointWriter& writer, const vector<T>& values) {
+    writer.putBytes(values.data(), values.size() * sizeof(T));
+}
+
+template <typename T>
+static void restoreVector(CheckpointReader& reader, vector<T>& values) {
+    reader.getBytes(values.data(), values.size() * sizeof(T));
+}
+
+// The engine state in its standard text form, which is the same for every
+// standard library
+static void saveEngine(CheckpointWriter& writer, const mt19937_64& rng) {
+    ostringstream state;
+    state << rng;
+    writer.putString(state.str());
+}
+
+static void restoreEngine(CheckpointReader& reader, mt19937_64& rng) {
+    istringstream state(reader.getString());
+    state >> rng;
+    if (!state) {
+        throw invalid_argument("Checkpoint holds a bad random number generator state");
+    }
+}
+
+// LRU and FIFO: evict the line with the oldest timestamp. LRU stamps a line
+// on every access, FIFO only when it is filled.
+class StampPolicy : public ReplacementPolicy {
+    vector<uint64_t> stamps;
+    uint64_t clock = 0;
+    bool stampOnHit;
+
+   public:
+    StampPolicy(uint64_t sets, uint64_t ways, bool stampOnHit)
+        : ReplacementPolicy(sets, ways), stamps(sets * ways, 0), stampOnHit(stampOnHit) {}
+
+    void onHit(uint64_t set, uint64_t way) override {
+        if (stampOnHit) {
+            stamps[set * ways + way] = ++clock;
+        }
+    }
+
+    void onFill(uint64_t set, uint64_t way) override { stamps[set * ways + way] = ++clock; }
+
+    uint64_t victim(uint64_t set) override {
+        const uint64_t* setStamps = &stamps[set * ways];
+        uint64_t victimWay = 0;
+        for (uint64_t way = 1; way < ways; way++) {
+            if (setStamps[way] < setStamps[victimWay]) {
+                victimWay = way;
+            }
+        }
+        return victimWay;
+    }
+
+    void saveCheckpoint(CheckpointWriter& writer) const override {
+        writer.put(clock);
+        saveVector(writer, stamps);
+    }
+
+    void restoreCheckpoint(CheckpointReader& reader) override {
+        clock = reader.get<uint64_t>();
+        restoreVector(reader, stamps);
+    }
+};
+
+// Tree pseudo-LRU: ways - 1 bits per set form a binary tree over the ways,
+// each bit pointing to the half that was used less recently
+class TreePlruPolicy : public ReplacementPolicy {
+    vector<uint64_t> trees;  // one tree per set, node i has children 2i+1, 2i+2
+    uint64_t levels = 0;
+
+    void touch(uint64_t set, uint64_t way) {
+        uint64_t& tree = trees[set];
+        uint64_t node = 0;
+        for (uint64_t level = levels; level-- > 0;) {
+            uint64_t right = (way >> level) & 1;
+            // point away from the half just used
+            if (right) {
+                tree &= ~(1ULL << node);
+            } else {
+                tree |= 1ULL << node;
+            }
+            node = 2 * node + 1 + right;
+        }
+    }
+
+   public:
+    TreePlruPolicy(uint64_t sets, uint64_t ways) : ReplacementPolicy(sets, ways), trees(sets, 0) {
+        if (ways == 0 || ways > 64 || (ways & (ways - 1)) != 0) {
+            throw invalid_argument("plru needs a power-of-two number of ways up to 64");
+        }
+        while ((1ULL << levels) < ways) levels++;
+    }
+
+    void onHit(uint64_t set, uint64_t way) override { touch(set, way); }
+    void onFill(uint64_t set, uint64_t way) override { touch(set, way); }
+
+    uint64_t victim(uint64_t set) override {
+        uint64_t tree = trees[set];
+        uint64_t node = 0;
+        uint64_t way = 0;
+        for (uint64_t level = 0; level < levels; level++) {
+            uint64_t right = (tree >> node) & 1;
+            way = way << 1 | right;
+            node = 2 * node + 1 + right;
+        }
+        return way;
+    }
+
+    void saveCheckpoint(CheckpointWriter& writer) const override { saveVector(writer, trees); }
+    void restoreCheckpoint(CheckpointReader& reader) override { restoreVector(reader, trees); }
+};
+
+// Random: mt19937_64 produces the same sequence on every standard library,
+// and taking it modulo ways keeps the victims reproducible for a given seed
+class RandomPolicy : public ReplacementPolicy {
+    mt19937_64 rng;
+
+   public:
+    RandomPolicy(uint64_t sets, uint64_t ways, uint64_t seed)
+        : ReplacementPolicy(sets, ways), rng(seed) {}
+
+    void onHit(uint64_t, uint64_t) override {}
+    void onFill(uint64_t, uint64_t) override {}
+    uint64_t victim(uint64_t) override { return rng() % ways; }
+
+    void saveCheckpoint(CheckpointWriter& writer) const override { saveEngine(writer, rng); }
+    void restoreCheckpoint(CheckpointReader& reader) override { restoreEngine(reader, rng); }
+};
+
+// NRU: evict the first line not referenced since the bits were last cleared,
+// clearing the bits of the set once all lines are referenced
+class NruPolicy : public ReplacementPolicy {
+    vector<uint8_t> referenced;
+
+   public:
+    NruPolicy(uint64_t sets, uint64_t ways)
+        : ReplacementPolicy(sets, ways), referenced(sets * ways, 0) {}
+
+    void onHit(uint64_t set, uint64_t way) override { referenced[set * ways + way] = 1; }
+    void onFill(uint64_t set, uint64_t way) override { referenced[set * ways + way] = 1; }
+
+    uint64_t victim(uint64_t set) override {
+        uint8_t* setBits = &referenced[set * ways];
+        for (uint64_t way = 0; way < ways; way++) {
+            if (!setBits[way]) {
+                return way;
+            }
+        }
+        fill(setBits, setBits + ways, 0);
+        return 0;
+    }
+
+    void saveCheckpoint(CheckpointWriter& writer) const override {
+        saveVector(writer, referenced);
+    }
+
+    void restoreCheckpoint(CheckpointReader& reader) override {
+        restoreVector(reader, referenced);
+    }
+};
+
+// SRRIP and BRRIP (Jaleel et al., ISCA 2010) with 2-bit re-reference
+// prediction values. A hit predicts a near re-reference, SRRIP fills at the
+// long interval and BRRIP at the distant one, except for one fill in 32.
+class RripPolicy : public ReplacementPolicy {
+    static const uint8_t RRPV_MAX = 3;
+    static const uint64_t BRRIP_LONG_FILLS = 32;  // one in this many fills is long
+
+    vector<uint8_t> rrpv;
+    bool bimodal;
+    mt19937_64 rng;
+
+   public:
+    RripPolicy(uint64_t sets, uint64_t ways, bool bimodal, uint64_t seed)
+        : ReplacementPolicy(sets, ways), rrpv(sets * ways, RRPV_MAX), bimodal(bimodal), rng(seed) {}
+
+    void onHit(uint64_t set, uint64_t way) override { rrpv[set * ways + way] = 0; }
+
+    void onFill(uint64_t set, uint64_t way) override {
+        bool distant = bimodal && rng() % BRRIP_LONG_FILLS != 0;
+        rrpv[set * ways + way] = distant ? RRPV_MAX : RRPV_MAX - 1;
+    }
+
+    uint64_t victim(uint64_t set) override {
+        uint8_t* setRrpv = &rrpv[set * ways];
+        while (true) {
+            for (uint64_t way = 0; way < ways; way++) {
+                if (setRrpv[way] == RRPV_MAX) {
+                    return way;
+                }
+            }
+            for (uint64_t way = 0; way < ways; way++) {
+                setRrpv[way]++;
+            }
+        }
+    }
+
+    void saveCheckpoint(CheckpointWriter& writer) const override {
+        saveVector(writer, rrpv);
+        saveEngine(writer, rng);
+    }
+
+    void restoreCheckpoint(CheckpointReader& reader) override {
+        restoreVector(reader, rrpv);
+        restoreEngine(reader, rng);
+    }
+};
+
+const uint8_t RripPolicy::RRPV_MAX;
+const uint64_t RripPolicy::BRRIP_LONG_FILLS;
+
+unique_ptr<ReplacementPolicy> ReplacementPolicy::create(ReplacementKind kind, uint64_t sets,
+                                                        uint64_t ways, uint64_t seed) {
+    switch (kind) {
+        case REPL_LRU:
+            return unique_ptr<ReplacementPolicy>(new StampPolicy(sets, ways, true));
+        case REPL_PLRU:
+            return unique_ptr<ReplacementPolicy>(new TreePlruPolicy(sets, ways));
+        case REPL_FIFO:
+            return unique_ptr<ReplacementPolicy>(new StampPolicy(sets, ways, false));
+        case REPL_RANDOM:
+            return unique_ptr<ReplacementPolicy>(new RandomPolicy(sets, ways, seed));
+        case REPL_NRU:
+            return unique_ptr<ReplacementPolicy>(new NruPolicy(sets, ways));
+        case REPL_SRRIP:
+            return unique_ptr<ReplacementPolicy>(new RripPolicy(sets, ways, false, seed));
+        case REPL_BRRIP:
+            return unique_ptr<ReplacementPolicy>(new RripPolicy(sets, ways, true, seed));
+    }
+    throw invalid_argument("Unknown replacement policy");
+}
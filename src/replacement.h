@@ -0,0 +1,61 @@
+#pragma once
+#include <inttypes.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class CheckpointWriter;
+class CheckpointReader;
+
+enum ReplacementKind {
+    REPL_LRU = 0,  // true LRU
+    REPL_PLRU,     // tree pseudo-LRU, needs a power-of-two number of ways
+    REPL_FIFO,     // evict the line filled first
+    REPL_RANDOM,   // evict a random line, seeded for reproducible runs
+    REPL_NRU,      // not recently used, one reference bit per line
+    REPL_SRRIP,    // static re-reference interval prediction, 2-bit RRPV
+    REPL_BRRIP,    // bimodal RRIP, fills mostly at the distant interval
+};
+
+// name used in cache_config.txt and in the stats, "lru", "plru", ...
+const char* replacementName(ReplacementKind kind);
+
+// parse a name back, throws std::invalid_argument for unknown names
+ReplacementKind parseReplacementKind(const std::string& name);
+
+// Replacement state of a whole cache. The cache fills invalid ways itself
+// and only asks the policy for a victim once a set is full.
+class ReplacementPolicy {
+   protected:
+    uint64_t numberOfSets;
+    uint64_t ways;
+
+   public:
+    ReplacementPolicy(uint64_t sets, uint64_t ways) : numberOfSets(sets), ways(ways) {}
+    virtual ~ReplacementPolicy() {}
+
+    // the line at (set, way) was accessed and hit
+    virtual void onHit(uint64_t set, uint64_t way) = 0;
+
+    // a new line was filled into (set, way)
+    virtual void onFill(uint64_t set, uint64_t way) = 0;
+
+    // way to evict from a full set
+    virtual uint64_t victim(uint64_t set) = 0;
+
+    // write the replacement state to a checkpoint, and read it back
+    virtual void saveCheckpoint(CheckpointWriter& writer) const = 0;
+    virtual void restoreCheckpoint(CheckpointReader& reader) = 0;
+
+    /** Create the policy state for a cache
+     * @return the policy, throws std::invalid_argument if the geometry does
+     *         not suit it
+     * @param
+     *      kind: which policy
+     *      sets, ways: cache geometry
+     *      seed: seed of the random number generator, for random and BRRIP
+     */
+    static std::unique_ptr<ReplacementPolicy> create(ReplacementKind kind, uint64_t sets,
+                                                     uint64_t ways, uint64_t seed);
+};
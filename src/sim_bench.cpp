@@ -0,0 +1,568 @@
+/** NOTE simulator benchmarks
+ * Throughput benchmarks for the simulator. Each invocation runs one
+ * measurement so that file-static simulator state starts out clean;
+ * `make bench` runs the interesting combinations.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "MemoryStore.h"
+#include "Utilities.h"
+#include "cache.h"
+#include "cycle.h"
+#include "simulator.h"
+#include "stack_distance.h"
+#include "translate.h"
+
+using namespace std;
+
+// Encoders for the handful of RV64I formats used by the synthetic workload
+static uint32_t encodeR(uint32_t opcode, uint32_t rd, uint32_t funct3, uint32_t rs1, uint32_t rs2,
+                        uint32_t funct7) {
+    return funct7 << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode;
+}
+
+static uint32_t encodeI(uint32_t opcode, uint32_t rd, uint32_t funct3, uint32_t rs1, int32_t imm) {
+    return ((uint32_t)imm & 0xfff) << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode;
+}
+
+static uint32_t encodeS(uint32_t opcode, uint32_t funct3, uint32_t rs1, uint32_t rs2, int32_t imm) {
+    uint32_t uimm = (uint32_t)imm & 0xfff;
+    return (uimm >> 5) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | (uimm & 0x1f) << 7 | opcode;
+}
+
+static uint32_t encodeB(uint32_t funct3, uint32_t rs1, uint32_t rs2, int32_t imm) {
+    uint32_t uimm = (uint32_t)imm & 0x1fff;
+    return ((uimm >> 12) & 0x1) << 31 | ((uimm >> 5) & 0x3f) << 25 | rs2 << 20 | rs1 << 15 |
+           funct3 << 12 | ((uimm >> 1) & 0xf) << 8 | ((uimm >> 11) & 0x1) << 7 | OP_BRANCH;
+}
+
+static uint32_t encodeU(uint32_t opcode, uint32_t rd, uint32_t imm20) {
+    return (imm20 & 0xfffff) << 12 | rd << 7 | opcode;
+}
+
+// Build a load/add/store loop that runs iterations * 4096 times and halts
+static MemoryStore* buildLoopProgram(uint64_t iterations) {
+    enum { ZERO = 0, T0 = 5, T1 = 6, T3 = 28, T4 = 29 };
+    const uint32_t program[] = {
+        encodeI(OP_INTIMM, T0, FUNCT3_ADD, ZERO, 0x400),         // t0 = data
+        encodeU(OP_LUI, T1, (uint32_t)iterations),               // t1 = iterations << 12
+        encodeI(OP_LOAD, T3, FUNCT3_W, T0, 0),                   // loop: t3 = *t0
+        encodeI(OP_INTIMM, T3, FUNCT3_ADD, T3, 1),               // t3++
+        encodeS(OP_STORE, FUNCT3_W, T0, T3, 0),                  // *t0 = t3
+        encodeR(OP_INT, T4, FUNCT3_ADD, T4, T3, FUNCT7_ADD),     // t4 += t3
+        encodeI(OP_INTIMM, T1, FUNCT3_ADD, T1, -1),              // t1--
+        encodeB(FUNCT3_BNE, T1, ZERO, -20),                      // if t1 != 0 goto loop
+        0xfeedfeed,
+    };
+
+    MemoryStore* mem = new MemoryStore(0, MEMORY_SIZE);
+    for (size_t i = 0; i < sizeof(program) / sizeof(program[0]); i++) {
+        mem->setMemValue(i * WORD_SIZE, program[i], WORD_SIZE);
+    }
+    return mem;
+}
+
+static void report(const char* name, uint64_t units, const char* unitName,
+                   chrono::steady_clock::duration elapsed) {
+    double seconds = chrono::duration<double>(elapsed).count();
+    cout << left << setw(28) << name << units << " " << unitName << " in " << fixed
+         << setprecision(3) << seconds << " s (" << setprecision(0)
+         << (seconds > 0 ? units / seconds : 0) << " " << unitName << "/s)" << endl;
+}
+
+// Cycle-accurate simulator throughput, with the pipe state trace on or off
+static int benchCycle(uint64_t iterations, const PipeTraceConfig& traceConfig) {
+    CacheConfig iCacheConfig{2048, 16, 2, 5};
+    CacheConfig dCacheConfig{4096, 16, 4, 8};
+
+    setPipeTraceConfig(traceConfig);
+    initSimulator(iCacheConfig, dCacheConfig, buildLoopProgram(iterations), "bench_cycle");
+
+    auto start = chrono::steady_clock::now();
+    runTillHalt();
+    auto elapsed = chrono::steady_clock::now() - start;
+
+    const char* name = traceConfig.mode == TRACE_OFF         ? "cycle (trace off)"
+                       : traceConfig.mode == TRACE_SAMPLED   ? "cycle (trace sampled)"
+                       : traceConfig.format == TRACE_BINARY ? "cycle (binary trace)"
+                                                             : "cycle (trace on)";
+    report(name, getCycleCount(), "cycles", elapsed);
+    finalizeSimulator();
+    return SUCCESS;
+}
+
+// Functional simulator throughput: simInstruction() with or without the
+// pre-decoded instruction cache, or the translated execution engine
+static int benchFunct(uint64_t iterations, bool decodeCache, bool translate) {
+    Simulator simulator;
+    simulator.setMemory(buildLoopProgram(iterations));
+    simulator.setDecodeCacheEnabled(decodeCache);
+    Translator translator(&simulator);
+
+    uint64_t PC = 0;
+    auto start = chrono::steady_clock::now();
+    if (translate) {
+        translator.run(PC, 0);
+    } else {
+        while (true) {
+            Simulator::Instruction inst = simulator.simInstruction(PC);
+            PC = inst.nextPC;
+            if (inst.isHalt || !inst.isLegal) break;
+        }
+    }
+    auto elapsed = chrono::steady_clock::now() - start;
+
+    const char* name = translate      ? "funct (translated)"
+                       : decodeCache ? "funct (decode cache)"
+                                     : "funct (no decode cache)";
+    report(name, simulator.getDin(), "instructions", elapsed);
+    return SUCCESS;
+}
+
+// The byte-at-a-time accessor MemoryStore used before its single-copy fast
+// path, kept here as the baseline for the memory benchmark. It is kept out of
+// line like the real accessor so both pay for a call.
+__attribute__((noinline, noclone)) static int legacyGetOrSet(vector<uint8_t>& memArr, bool get, uint64_t address, uint64_t& value,
+                          MemEntrySize size) {
+    uint64_t byteSize = static_cast<uint64_t>(size);
+    if (get) {
+        value = 0;
+    }
+    for (uint64_t i = 0; i < byteSize; ++i) {
+        if (address + i >= memArr.size()) {
+            return -EINVAL;
+        }
+        if (get) {
+            value |= ((uint64_t)memArr.at(address + i) << (i * 8));
+        } else {
+            memArr.at(address + i) = (value >> (i * 8)) & 0xFF;
+        }
+    }
+    return 0;
+}
+
+// MemoryStore accessor throughput: word fetches over a code-sized region,
+// then a mixed load/store stream of all sizes at aligned and unaligned
+// addresses, for the fast path and for the legacy byte loop
+static int benchMemory(uint64_t iterations) {
+    const uint64_t region = 16 * 1024;
+    const uint64_t fetches = iterations * 1024 * 1024;
+    const MemEntrySize sizes[] = {BYTE_SIZE, HALF_SIZE, WORD_SIZE, DOUBLE_SIZE};
+    MemoryStore mem(0, MEMORY_SIZE);
+    vector<uint8_t> legacy(MEMORY_SIZE);
+    uint64_t value = 0;
+    uint64_t checksum = 0;
+
+    // Fill the region the way a loaded program would
+    vector<uint8_t> image(region, 0x13);
+    mem.writeBlock(0, image.data(), region);
+    copy(image.begin(), image.end(), legacy.begin());
+
+    auto start = chrono::steady_clock::now();
+    for (uint64_t i = 0; i < fetches; i++) {
+        mem.getMemValue((i * WORD_SIZE) % region, value, WORD_SIZE);
+        checksum += value;
+    }
+    report("memory fetch (fast)", fetches, "accesses", chrono::steady_clock::now() - start);
+
+    start = chrono::steady_clock::now();
+    for (uint64_t i = 0; i < fetches; i++) {
+        legacyGetOrSet(legacy, true, (i * WORD_SIZE) % region, value, WORD_SIZE);
+        checksum += value;
+    }
+    report("memory fetch (legacy)", fetches, "accesses", chrono::steady_clock::now() - start);
+
+    // Addresses step by 3 so that half and larger accesses are mostly unaligned
+    start = chrono::steady_clock::now();
+    for (uint64_t i = 0; i < fetches; i++) {
+        uint64_t address = (i * 3) % region;
+        MemEntrySize size = sizes[i & 3];
+        if (i & 4) {
+            mem.setMemValue(address, i, size);
+        } else {
+            mem.getMemValue(address, value, size);
+            checksum += value;
+        }
+    }
+    report("memory load/store (fast)", fetches, "accesses", chrono::steady_clock::now() - start);
+
+    start = chrono::steady_clock::now();
+    for (uint64_t i = 0; i < fetches; i++) {
+        uint64_t address = (i * 3) % region;
+        MemEntrySize size = sizes[i & 3];
+        uint64_t data = i;
+        if (i & 4) {
+            legacyGetOrSet(legacy, false, address, data, size);
+        } else {
+            legacyGetOrSet(legacy, true, address, value, size);
+            checksum += value;
+        }
+    }
+    report("memory load/store (legacy)", fetches, "accesses", chrono::steady_clock::now() - start);
+
+    // Keep the loops from being optimized away
+    return checksum == 1 ? ERROR : SUCCESS;
+}
+
+// Cache lookup throughput at a fixed 32 KB capacity for 1 to 16 ways, over
+// a pseudo-random stream of word addresses in a 48 KB footprint
+static int benchCache(uint64_t iterations) {
+    const uint64_t accesses = iterations * 1024 * 1024;
+    const uint64_t footprint = 48 * 1024;
+    vector<uint64_t> addresses(64 * 1024);  // power of two, indexed with a mask
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    for (uint64_t& address : addresses) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        address = (state % footprint) & ~3ULL;
+    }
+
+    for (uint64_t ways : {1, 2, 4, 8, 16}) {
+        Cache cache(CacheConfig{32 * 1024, 64, ways, 0}, D_CACHE);
+        auto start = chrono::steady_clock::now();
+        for (uint64_t i = 0; i < accesses; i++) {
+            cache.access(addresses[i & (addresses.size() - 1)], CACHE_READ);
+        }
+        string name = "cache " + to_string(ways) + "-way";
+        report(name.c_str(), accesses, "accesses", chrono::steady_clock::now() - start);
+        cout << "    hit rate " << setprecision(2)
+             << 100.0 * cache.getHits() / (cache.getHits() + cache.getMisses()) << "%" << endl;
+    }
+    return SUCCESS;
+}
+
+// Hit rate of every replacement policy on a 32 KB 8-way cache, for three
+// address streams: random words in a 48 KB footprint, a cyclic sweep over
+// 40 KB that true LRU always misses, and a 16 KB hot set interleaved with a
+// scan through 1 MB that never comes back
+static int benchReplacement(uint64_t iterations) {
+    const uint64_t streamLength = 256 * 1024;
+    const char* streamNames[] = {"random", "sweep", "hot+scan"};
+    vector<vector<uint64_t>> streams(3, vector<uint64_t>(streamLength));
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    uint64_t scan = 0;
+    for (uint64_t i = 0; i < streamLength; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        streams[0][i] = (state % (48 * 1024)) & ~3ULL;
+        streams[1][i] = (i * 64) % (40 * 1024);
+        if (i % 4 == 3) {
+            streams[2][i] = 0x100000 + (scan++ * 64) % (1024 * 1024);
+        } else {
+            streams[2][i] = (state % (16 * 1024)) & ~3ULL;
+        }
+    }
+
+    cout << left << setw(10) << "policy";
+    for (const char* streamName : streamNames) {
+        cout << setw(12) << streamName;
+    }
+    cout << "accesses/s" << endl;
+
+    for (int kind = REPL_LRU; kind <= REPL_BRRIP; kind++) {
+        CacheConfig config{32 * 1024, 64, 8, 0};
+        config.replacement = static_cast<ReplacementKind>(kind);
+        cout << left << setw(10) << replacementName(config.replacement);
+
+        uint64_t accesses = 0;
+        chrono::steady_clock::duration elapsed{};
+        for (const vector<uint64_t>& stream : streams) {
+            Cache cache(config, D_CACHE);
+            auto start = chrono::steady_clock::now();
+            for (uint64_t i = 0; i < iterations; i++) {
+                for (uint64_t address : stream) {
+                    cache.access(address, CACHE_READ);
+                }
+            }
+            elapsed += chrono::steady_clock::now() - start;
+            accesses += iterations * stream.size();
+            double hitRate = 100.0 * cache.getHits() / (cache.getHits() + cache.getMisses());
+            cout << fixed << setprecision(2) << setw(12) << hitRate;
+        }
+        double seconds = chrono::duration<double>(elapsed).count();
+        cout << setprecision(0) << (seconds > 0 ? accesses / seconds : 0) << endl;
+    }
+    return SUCCESS;
+}
+
+// A 50-point L1 sweep (1-16 KB, 16 and 64 byte blocks, 1-16 ways) over the
+// address streams of one cycle simulation, by stack-distance analysis and by
+// replaying the streams through a Cache per point. Both must agree.
+static int benchSweep(uint64_t iterations) {
+    vector<uint64_t> iStream;
+    vector<uint64_t> dStream;
+    CacheConfig iCacheConfig{2048, 16, 2, 5};
+    CacheConfig dCacheConfig{4096, 16, 4, 8};
+    setPipeTraceConfig(PipeTraceConfig{TRACE_OFF});
+    initSimulator(iCacheConfig, dCacheConfig, buildLoopProgram(iterations), "bench_sweep");
+    setCacheStreamRecording(&iStream, &dStream);
+    auto start = chrono::steady_clock::now();
+    runTillHalt();
+    report("sweep (one simulation)", getCycleCount(), "cycles", chrono::steady_clock::now() - start);
+    setCacheStreamRecording(nullptr, nullptr);
+
+    vector<SweepPoint> points;
+    for (uint64_t size = 1024; size <= 16 * 1024; size *= 2) {
+        for (uint64_t blockSize : {16, 64}) {
+            for (uint64_t ways = 1; ways <= 16; ways *= 2) {
+                points.push_back(SweepPoint{size, blockSize, ways, 0, 0});
+            }
+        }
+    }
+    uint64_t accesses = points.size() * (iStream.size() + dStream.size());
+
+    vector<SweepPoint> iPoints = points;
+    vector<SweepPoint> dPoints = points;
+    start = chrono::steady_clock::now();
+    if (sweepLruCaches(iStream, iPoints) != SUCCESS || sweepLruCaches(dStream, dPoints) != SUCCESS) {
+        return ERROR;
+    }
+    report("sweep (stack distance)", accesses, "accesses", chrono::steady_clock::now() - start);
+
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < points.size(); i++) {
+        Cache iCache(CacheConfig{points[i].cacheSize, points[i].blockSize, points[i].ways, 0},
+                     I_CACHE);
+        Cache dCache(CacheConfig{points[i].cacheSize, points[i].blockSize, points[i].ways, 0},
+                     D_CACHE);
+        for (uint64_t address : iStream) {
+            iCache.access(address, CACHE_READ);
+        }
+        for (uint64_t address : dStream) {
+            dCache.access(address, CACHE_READ);
+        }
+        if (iCache.getHits() != iPoints[i].hits || dCache.getHits() != dPoints[i].hits) {
+            cerr << LOG_ERROR << "Stack distances disagree with the cache at point " << i << endl;
+            return ERROR;
+        }
+    }
+    report("sweep (replay per point)", accesses, "accesses", chrono::steady_clock::now() - start);
+    return SUCCESS;
+}
+
+// Write a pseudo-random program image of imageSize bytes
+static int writeBenchImage(const string& imageFile, uint64_t imageSize) {
+    vector<uint8_t> image(imageSize);
+    for (uint64_t i = 0; i < imageSize; i++) {
+        image[i] = (uint8_t)(i * 2654435761u >> 13);
+    }
+    ofstream out(imageFile, ios::binary);
+    out.write(reinterpret_cast<const char*>(image.data()), imageSize);
+    if (!out) {
+        cerr << LOG_ERROR << "Could not write " << imageFile << endl;
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+// Program image load time for a multi-megabyte image: the mapped bulk copy
+// in loadFromFile() against loading it one setMemValue() byte at a time
+static int benchStartup(uint64_t imageMB) {
+    const uint64_t imageSize = imageMB * 1024 * 1024;
+    const string imageFile = "bench_image.bin";
+    if (writeBenchImage(imageFile, imageSize) != SUCCESS) {
+        return ERROR;
+    }
+
+    MemoryStore fast(0, imageSize);
+    auto start = chrono::steady_clock::now();
+    int ret = fast.loadFromFile(imageFile.c_str());
+    report("startup (mapped)", imageSize, "bytes", chrono::steady_clock::now() - start);
+
+    MemoryStore slow(0, imageSize);
+    start = chrono::steady_clock::now();
+    ifstream in(imageFile, ios::binary);
+    vector<char> buf(imageSize);
+    in.read(buf.data(), imageSize);
+    for (uint64_t i = 0; i < imageSize; i++) {
+        slow.setMemValue(i, (uint8_t)buf[i], BYTE_SIZE);
+    }
+    report("startup (per byte)", imageSize, "bytes", chrono::steady_clock::now() - start);
+
+    uint64_t a = 0, b = 0;
+    fast.getMemValue(imageSize - DOUBLE_SIZE, a, DOUBLE_SIZE);
+    slow.getMemValue(imageSize - DOUBLE_SIZE, b, DOUBLE_SIZE);
+    return ret == SUCCESS && a == b ? SUCCESS : ERROR;
+}
+
+// Time to get a fresh copy of a loaded image for each of a number of runs:
+// reloading it from the file against cloning a pristine copy-on-write image.
+// Each run writes one word per 64 KB, as a short simulation would.
+static int benchReset(uint64_t imageMB, uint64_t runs) {
+    const uint64_t imageSize = imageMB * 1024 * 1024;
+    const string imageFile = "bench_image.bin";
+    if (writeBenchImage(imageFile, imageSize) != SUCCESS) {
+        return ERROR;
+    }
+
+    auto simulateRun = [&](MemoryStore* mem, uint64_t run) {
+        for (uint64_t address = 0; address < imageSize; address += 64 * 1024) {
+            mem->setMemValue(address, run, WORD_SIZE);
+        }
+    };
+
+    auto start = chrono::steady_clock::now();
+    for (uint64_t run = 0; run < runs; run++) {
+        MemoryStore* mem = new MemoryStore(0, imageSize, imageFile.c_str());
+        simulateRun(mem, run);
+        delete mem;
+    }
+    report("reset (reload)", runs, "runs", chrono::steady_clock::now() - start);
+
+    MemoryStore pristine(0, imageSize, imageFile.c_str());
+    uint64_t before = 0;
+    pristine.getMemValue(0, before, WORD_SIZE);
+    start = chrono::steady_clock::now();
+    for (uint64_t run = 0; run < runs; run++) {
+        MemoryStore* mem = pristine.clone();
+        simulateRun(mem, run);
+        delete mem;
+    }
+    report("reset (clone)", runs, "runs", chrono::steady_clock::now() - start);
+
+    // The pristine image must be untouched by the runs
+    uint64_t after = 0;
+    pristine.getMemValue(0, after, WORD_SIZE);
+    return before == after ? SUCCESS : ERROR;
+}
+
+// init_mem_image load time for a multi-megabyte preload: the text format of
+// hex address/word pairs against the binary segment format
+static int benchPreload(uint64_t imageMB) {
+    const uint64_t imageSize = imageMB * 1024 * 1024;
+    const string textFile = "bench_init_mem.txt";
+    const string binaryFile = "bench_init_mem.bin";
+    {
+        vector<uint8_t> bytes(imageSize);
+        ofstream text_out(textFile);
+        for (uint64_t address = 0; address < imageSize; address += WORD_SIZE) {
+            uint32_t word = (uint32_t)(address * 2654435761u);
+            text_out << hex << address << " " << word << "\n";
+            memcpy(&bytes[address], &word, WORD_SIZE);
+        }
+
+        ofstream binary_out(binaryFile, ios::binary);
+        MemImageHeader header{MEM_IMAGE_MAGIC, MEM_IMAGE_VERSION, 1};
+        MemImageSegment segment{0, imageSize};
+        binary_out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        binary_out.write(reinterpret_cast<const char*>(&segment), sizeof(segment));
+        binary_out.write(reinterpret_cast<const char*>(bytes.data()), imageSize);
+        if (!text_out || !binary_out) {
+            cerr << LOG_ERROR << "Could not write the preload images" << endl;
+            return ERROR;
+        }
+    }
+
+    MemoryStore text(0, imageSize);
+    auto start = chrono::steady_clock::now();
+    int ret = prepareMemory(&text, textFile.c_str());
+    report("preload (text)", imageSize, "bytes", chrono::steady_clock::now() - start);
+
+    MemoryStore binary(0, imageSize);
+    start = chrono::steady_clock::now();
+    ret |= prepareMemory(&binary, binaryFile.c_str());
+    report("preload (binary)", imageSize, "bytes", chrono::steady_clock::now() - start);
+
+    uint64_t a = 0, b = 0;
+    text.getMemValue(imageSize - WORD_SIZE, a, WORD_SIZE);
+    binary.getMemValue(imageSize - WORD_SIZE, b, WORD_SIZE);
+    return ret == 0 && a == b ? SUCCESS : ERROR;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        cerr << LOG_ERROR << "Usage: " << argv[0] << " <benchmark> [options]" << endl
+             << "Benchmarks:" << endl
+             << "  cycle [--no-trace] [--trace-every=N] [--binary-trace] [--iterations=N]" << endl
+             << "        cycle simulator throughput" << endl
+             << "  funct [--no-decode-cache] [--translate] [--iterations=N]" << endl
+             << "        functional simulator throughput" << endl
+             << "  memory [--iterations=N]" << endl
+             << "        memory accessor throughput against the legacy byte loop" << endl
+             << "  cache [--iterations=N]" << endl
+             << "        cache lookup throughput for 1 to 16 ways" << endl
+             << "  sweep [--iterations=N]" << endl
+             << "        50-point L1 sweep, stack distances against per-point replay" << endl
+             << "  replacement [--iterations=N]" << endl
+             << "        hit rate of each replacement policy on three address streams" << endl
+             << "  startup [--image-mb=N]" << endl
+             << "        program image load time" << endl
+             << "  reset [--image-mb=N] [--iterations=N]" << endl
+             << "        per-run image reset time, reloading against cloning" << endl
+             << "  preload [--image-mb=N]" << endl
+             << "        init_mem_image load time, text against binary" << endl;
+        return ERROR;
+    }
+
+    string benchmark = argv[1];
+    PipeTraceConfig traceConfig;
+    bool decodeCache = true;
+    bool translate = false;
+    uint64_t iterations = 16;
+    uint64_t imageMB = 64;
+    try {
+        for (int i = 2; i < argc; i++) {
+            string arg = argv[i];
+            if (arg == "--no-trace") {
+                traceConfig.mode = TRACE_OFF;
+            } else if (arg == "--binary-trace") {
+                traceConfig.format = TRACE_BINARY;
+            } else if (arg.compare(0, 14, "--trace-every=") == 0) {
+                traceConfig.mode = TRACE_SAMPLED;
+                traceConfig.interval = stoull(arg.substr(14));
+                if (traceConfig.interval == 0) {
+                    throw invalid_argument("--trace-every needs a non-zero interval");
+                }
+            } else if (arg == "--no-decode-cache") {
+                decodeCache = false;
+            } else if (arg == "--translate") {
+                translate = true;
+            } else if (arg.compare(0, 13, "--iterations=") == 0) {
+                iterations = stoull(arg.substr(13));
+            } else if (arg.compare(0, 11, "--image-mb=") == 0) {
+                imageMB = stoull(arg.substr(11));
+            } else {
+                throw invalid_argument("Unknown option " + arg);
+            }
+        }
+    } catch (const invalid_argument& e) {
+        cerr << LOG_ERROR << e.what() << endl;
+        return ERROR;
+    } catch (const out_of_range& e) {
+        cerr << LOG_ERROR << "One of the integer arguments is out of range." << endl;
+        return ERROR;
+    }
+
+    if (benchmark == "cycle") {
+        return benchCycle(iterations, traceConfig);
+    } else if (benchmark == "funct") {
+        return benchFunct(iterations, decodeCache, translate);
+    } else if (benchmark == "memory") {
+        return benchMemory(iterations);
+    } else if (benchmark == "cache") {
+        return benchCache(iterations);
+    } else if (benchmark == "sweep") {
+        return benchSweep(iterations);
+    } else if (benchmark == "replacement") {
+        return benchReplacement(iterations);
+    } else if (benchmark == "startup") {
+        return benchStartup(imageMB);
+    } else if (benchmark == "reset") {
+        return benchReset(imageMB, iterations);
+    } else if (benchmark == "preload") {
+        return benchPreload(imageMB);
+    }
+
+    cerr << LOG_ERROR << "Unknown benchmark " << benchmark << endl;
+    return ERROR;
+}
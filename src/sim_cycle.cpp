@@ -7,22 +7,178 @@
 #include <iostream>
 #include <string>
 #include <tuple>
+#include <vector>
 
 #include "cache.h"
+#include "checkpoint.h"
 #include "MemoryStore.h"
 #include "Utilities.h"
 #include "cycle.h"
+#include "stack_distance.h"
 
 using namespace std;
 
-inline std::tuple<std::string, CacheConfig, CacheConfig> parseArgs(int argc, char** argv) {
-    if (argc != 3) {
+// read the "<size> <block size> <ways>" lines of a sweep file
+inline std::vector<SweepPoint> readSweepPoints(const std::string& sweepFile) {
+    std::ifstream file(sweepFile);
+    if (!file.is_open()) {
+        throw std::invalid_argument("Failed to open sweep file: " + sweepFile);
+    }
+    std::vector<SweepPoint> points;
+    std::string entry;
+    int line = 0;
+    while (std::getline(file, entry)) {
+        line++;
+        std::istringstream fields(entry.substr(0, entry.find('#')));
+        SweepPoint point{0, 0, 0, 0, 0};
+        if (!(fields >> point.cacheSize)) {
+            continue;
+        }
+        if (!(fields >> point.blockSize >> point.ways)) {
+            std::stringstream errorMessage;
+            errorMessage << "Expected <size> <block size> <ways> at line " << line << " of "
+                         << sweepFile;
+            throw std::invalid_argument(errorMessage.str());
+        }
+        points.push_back(point);
+    }
+    return points;
+}
+
+// write the hits and misses of every sweep point for both L1 caches
+inline Status writeSweepTable(const std::string& base_output_name,
+                              const std::vector<SweepPoint>& iPoints,
+                              const std::vector<SweepPoint>& dPoints) {
+    std::ofstream sweep_out(base_output_name + "_cache_sweep.csv");
+    if (!sweep_out) {
+        std::cerr << LOG_ERROR << "Could not open cache sweep file!" << std::endl;
+        return ERROR;
+    }
+    sweep_out << "size,block_size,ways,icache_hits,icache_misses,dcache_hits,dcache_misses"
+              << std::endl;
+    for (size_t i = 0; i < iPoints.size(); i++) {
+        sweep_out << iPoints[i].cacheSize << "," << iPoints[i].blockSize << ","
+                  << iPoints[i].ways << "," << iPoints[i].hits << "," << iPoints[i].misses << ","
+                  << dPoints[i].hits << "," << dPoints[i].misses << std::endl;
+    }
+    return SUCCESS;
+}
+
+// Which part of the program runs in detail: the instructions before it run
+// on the functional path, and the run stops after maxCycles cycles
+struct RegionOfInterest {
+    uint64_t fastForward = 0;  // 0: start in detail
+    bool warmCaches = false;
+    uint64_t maxCycles = 0;  // 0: run till halt
+};
+
+// parse the optional arguments following the two required ones
+inline PipeTraceConfig parseOptionArgs(int argc, char** argv, uint64_t& memorySize,
+                                       bool& perfStats, std::string& sweepFile,
+                                       CheckpointOptions& checkpoints, RegionOfInterest& roi) {
+    PipeTraceConfig traceConfig;
+    for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if (checkpoints.parse(arg)) {
+            // --checkpoint-at, --checkpoint-every or --restore
+        } else if (arg.compare(0, 15, "--fast-forward=") == 0) {
+            roi.fastForward = std::stoull(arg.substr(15));
+        } else if (arg == "--warm-caches") {
+            roi.warmCaches = true;
+        } else if (arg.compare(0, 13, "--max-cycles=") == 0) {
+            roi.maxCycles = std::stoull(arg.substr(13));
+        } else if (arg.compare(0, 14, "--memory-size=") == 0) {
+            memorySize = std::stoull(arg.substr(14), nullptr, 0);
+            if (memorySize == 0) {
+                throw std::invalid_argument("--memory-size needs a non-zero size");
+            }
+        } else if (arg == "--perf-stats") {
+            perfStats = true;
+        } else if (arg.compare(0, 8, "--sweep=") == 0) {
+            sweepFile = arg.substr(8);
+        } else if (arg == "--trace=full") {
+            traceConfig.mode = TRACE_FULL;
+        } else if (arg == "--trace=off") {
+            traceConfig.mode = TRACE_OFF;
+        } else if (arg == "--trace-format=text") {
+            traceConfig.format = TRACE_TEXT;
+        } else if (arg == "--trace-format=binary") {
+            traceConfig.format = TRACE_BINARY;
+        } else if (arg.compare(0, 14, "--trace-every=") == 0) {
+            traceConfig.mode = TRACE_SAMPLED;
+            traceConfig.interval = std::stoull(arg.substr(14));
+            if (traceConfig.interval == 0) {
+                throw std::invalid_argument("--trace-every needs a non-zero interval");
+            }
+        } else if (arg.compare(0, 15, "--trace-window=") == 0) {
+            std::string window = arg.substr(15);
+            size_t colon = window.find(':');
+            if (colon == std::string::npos) {
+                throw std::invalid_argument("--trace-window expects <start>:<end>");
+            }
+            traceConfig.mode = TRACE_WINDOW;
+            traceConfig.windowStart = std::stoull(window.substr(0, colon));
+            traceConfig.windowEnd = std::stoull(window.substr(colon + 1));
+            if (traceConfig.windowStart > traceConfig.windowEnd) {
+                throw std::invalid_argument("--trace-window needs START <= END");
+            }
+        } else {
+            throw std::invalid_argument("Unknown option " + arg);
+        }
+    }
+    return traceConfig;
+}
+
+inline std::tuple<std::string, CacheConfig, CacheConfig, PipeTraceConfig, uint64_t, bool,
+                  std::vector<CacheConfig>, std::vector<SweepPoint>, CheckpointOptions,
+                  RegionOfInterest>
+parseArgs(int argc, char** argv) {
+    if (argc < 3) {
         std::cerr << LOG_ERROR << "Usage: " << argv[0] << " <file.bin> <cache_config.txt>"
+                  << " [--trace=full|off] [--trace-every=N] [--trace-window=START:END]"
+                  << " [--trace-format=text|binary] [--memory-size=BYTES] [--perf-stats]"
+                  << " [--sweep=FILE] [--checkpoint-at=N] [--checkpoint-every=N] [--restore=FILE]"
+                  << " [--fast-forward=N] [--warm-caches] [--max-cycles=N]"
                   << std::endl
                   << "Note:" << std::endl
                   << "The sim_cycle binary should take two command-line arguments indicating the "
                      "name of the binary file to be read and the cache configuration file to be "
-                     "used. [See detail in project description document]."
+                     "used. [See detail in project description document]. A cache size of 0 "
+                     "configures an ideal cache. The numeric lines can be followed by "
+                     "\"<icache|dcache>.replacement=lru|plru|fifo|random|nru|srrip|brrip\" "
+                     "and \"<icache|dcache>.seed=N\" lines, and the D-cache write policy by "
+                     "\"dcache.write_policy=write-back|write-through\", "
+                     "\"dcache.write_miss=allocate|no-allocate\" and "
+                     "\"dcache.writeback_latency=N\" (write-through and allocate by default). A shared L2 and L3 are added by setting "
+                     "\"<l2|l3>.size\", \"block_size\", \"ways\" and \"miss_latency\" (the "
+                     "L1 miss latency then is the time to reach L2), plus any of the properties "
+                     "above and \"inclusion=nine|inclusive|exclusive\"."
+                  << std::endl
+                  << "The optional trace arguments select which cycles are written to the pipe "
+                     "state trace: all of them (default), none, every Nth cycle or only the "
+                     "cycles in [START, END]. The binary trace format is written to "
+                     "_pipe_state.bin and can be turned into text with pipe_decode."
+                  << std::endl
+                  << "--memory-size sets the size of the simulated address space (default 64 KB); "
+                     "memory is only allocated as it is written."
+                  << std::endl
+                  << "--sweep records the L1 address streams and writes the hits and misses of "
+                     "every \"<size> <block size> <ways>\" line of FILE, for true-LRU "
+                     "write-allocate I- and D-caches, to _cache_sweep.csv in a single run."
+                  << std::endl
+                  << "--perf-stats appends the stall, flush and cache stall counters and the CPI "
+                     "to _sim_stats.out."
+                  << std::endl
+                  << "--checkpoint-at and --checkpoint-every write the registers, memory, "
+                     "pipeline, counters and cache state after cycle N (and every N cycles) to "
+                     "_cycle_<N>.ckpt. --restore resumes from such a checkpoint, taken with the "
+                     "same cache config, or starts from a sim_funct checkpoint with an empty "
+                     "pipeline and cold caches; file.bin then only names the output files."
+                  << std::endl
+                  << "--fast-forward runs the first N instructions on the functional path and "
+                     "starts the pipeline after them, with cold caches unless --warm-caches sends "
+                     "their accesses to the caches first. Only the detailed run is counted in the "
+                     "statistics. --max-cycles stops the detailed run after N cycles."
                   << std::endl;
         exit(ERROR);
     }
@@ -30,39 +186,31 @@ inline std::tuple<std::string, CacheConfig, CacheConfig> parseArgs(int argc, cha
     try {
         std::string inputFile = argv[1];
         std::string cacheFile = argv[2];
-
-        std::ifstream file(cacheFile);
-        if (!file.is_open()) {
-            std::cerr << LOG_ERROR << "Failed to open cache config file: " << cacheFile
-                      << std::endl;
-            exit(ERROR);
+        uint64_t memorySize = MEMORY_SIZE;
+        bool perfStats = false;
+        std::string sweepFile;
+        CheckpointOptions checkpoints;
+        RegionOfInterest roi;
+        PipeTraceConfig traceConfig =
+            parseOptionArgs(argc, argv, memorySize, perfStats, sweepFile, checkpoints, roi);
+        std::vector<SweepPoint> sweepPoints;
+        if (!sweepFile.empty()) {
+            sweepPoints = readSweepPoints(sweepFile);
         }
 
-        int line = 0;
-        auto parseNextLine = [&](const char* name) -> uint32_t {
-            line++;
-            uint32_t value;
-            if (!(file >> value)) {
-                std::stringstream errorMessage;
-                errorMessage << "Failed to parse property at line " << line << " for property "
-                             << name;
-                throw std::invalid_argument(errorMessage.str());
-            }
-            std::string discard;
-            std::getline(file, discard);  // discard rest of the line
-            return value;
-        };
-
-        CacheConfig icConfig{parseNextLine("ICache cache size"), parseNextLine("ICache block size"),
-                             parseNextLine("ICache ways"), parseNextLine("ICache miss latency")};
-
-        CacheConfig dcConfig{parseNextLine("DCache cache size"), parseNextLine("DCache block size"),
-                             parseNextLine("DCache ways"), parseNextLine("DCache miss latency")};
+        CacheConfig icConfig;
+        CacheConfig dcConfig;
+        std::vector<CacheConfig> lowerLevels;
+        readCacheConfigFile(cacheFile, icConfig, dcConfig, lowerLevels);
 
         std::cout << LOG_INFO << LOG_VAR(icConfig) << std::endl;
         std::cout << LOG_INFO << LOG_VAR(dcConfig) << std::endl;
+        for (const CacheConfig& config : lowerLevels) {
+            std::cout << LOG_INFO << "lower level: " << config << std::endl;
+        }
 
-        return std::make_tuple(inputFile, icConfig, dcConfig);
+        return std::make_tuple(inputFile, icConfig, dcConfig, traceConfig, memorySize,
+                               perfStats, lowerLevels, sweepPoints, checkpoints, roi);
 
     } catch (const std::invalid_argument& e) {
         std::cerr << LOG_ERROR << e.what() << std::endl;
@@ -78,18 +226,66 @@ int main(int argc, char** argv) {
     auto inputFile = std::get<0>(simArgs);
     auto iCacheConfig = std::get<1>(simArgs);
     auto dCacheConfig = std::get<2>(simArgs);
+    auto traceConfig = std::get<3>(simArgs);
+    auto memorySize = std::get<4>(simArgs);
+    auto perfStats = std::get<5>(simArgs);
+    auto lowerLevels = std::get<6>(simArgs);
+    auto sweepPoints = std::get<7>(simArgs);
+    auto checkpoints = std::get<8>(simArgs);
+    auto roi = std::get<9>(simArgs);
 
-    cout << "[Simulator] Loading memory from " << LOG_VAR(inputFile) << endl;
     auto baseFilename = getBaseFilename(argv[1]) + "_cycle";
-    initSimulator(iCacheConfig, dCacheConfig, new MemoryStore(0, MEMORY_SIZE, argv[1]),
-                  baseFilename);
+    setPipeTraceConfig(traceConfig);
+    setPerfStatsEnabled(perfStats);
+    setLowerCacheLevels(lowerLevels);
+    if (!checkpoints.restoreFile.empty()) {
+        cout << "[Simulator] Restoring checkpoint " << checkpoints.restoreFile << endl;
+        if (restoreSimulator(iCacheConfig, dCacheConfig, new MemoryStore(0, memorySize),
+                             checkpoints.restoreFile, baseFilename) != SUCCESS) {
+            return ERROR;
+        }
+    } else {
+        cout << "[Simulator] Loading memory from " << LOG_VAR(inputFile) << endl;
+        if (initSimulator(iCacheConfig, dCacheConfig, new MemoryStore(0, memorySize, argv[1]),
+                          baseFilename) != SUCCESS) {
+            return ERROR;
+        }
+    }
+
+    if (roi.fastForward != 0) {
+        cout << "[Simulator] Fast-forwarding " << roi.fastForward << " instructions"
+             << (roi.warmCaches ? " while warming the caches" : "") << endl;
+        if (fastForward(roi.fastForward, roi.warmCaches) != SUCCESS) {
+            return ERROR;
+        }
+        if (getFastForwardedInstructions() < roi.fastForward) {
+            cout << "[Simulator] Stopped fast-forwarding after " << getFastForwardedInstructions()
+                 << " instructions, before a halt or trap" << endl;
+        }
+    }
+
+    std::vector<uint64_t> iStream;
+    std::vector<uint64_t> dStream;
+    if (!sweepPoints.empty()) {
+        setCacheStreamRecording(&iStream, &dStream);
+    }
 
     cout << "[Simulator] Start simulator" << endl;
-    auto status = runTillHalt();
+    Status status = runWithCheckpoints(checkpoints, roi.maxCycles);
     //auto status = runCycles(10);
 
     cout << "[Simulator] Finished simulation status: " << status << endl;
     finalizeSimulator();
 
+    if (!sweepPoints.empty()) {
+        setCacheStreamRecording(nullptr, nullptr);
+        std::vector<SweepPoint> iPoints = sweepPoints;
+        if (sweepLruCaches(iStream, iPoints) != SUCCESS ||
+            sweepLruCaches(dStream, sweepPoints) != SUCCESS ||
+            writeSweepTable(baseFilename, iPoints, sweepPoints) != SUCCESS) {
+            return ERROR;
+        }
+    }
+
     return status;
 }
@@ -5,25 +5,71 @@
  */
 
 #include <iostream>
+#include <string>
 
 #include "MemoryStore.h"
 #include "Utilities.h"
+#include "checkpoint.h"
 #include "funct.h"
 
 using namespace std;
 
 int main(int argc, char** argv) {
     if (argc < 2) {
-        cerr << LOG_ERROR << "Usage: " << argv[0] << " <input_file>" << endl;
+        cerr << LOG_ERROR << "Usage: " << argv[0] << " <input_file> [--translate] [--memory-size=BYTES]"
+             << " [--checkpoint-at=N] [--checkpoint-every=N] [--restore=FILE]" << endl
+             << "--checkpoint-at and --checkpoint-every write the PC, registers and memory "
+                "after N instructions (and every N instructions) to _funct_<N>.ckpt. "
+                "--restore resumes from such a checkpoint instead of loading input_file, "
+                "which still names the output files."
+             << endl;
         return ERROR;
     }
 
-    cout << "[Simulator] Loading memory from " << LOG_VAR(argv[1]) << endl;
+    uint64_t memorySize = MEMORY_SIZE;
+    CheckpointOptions checkpoints;
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        try {
+            if (checkpoints.parse(arg)) {
+                continue;
+            }
+        } catch (const exception& e) {
+            cerr << LOG_ERROR << "Invalid option " << arg << endl;
+            return ERROR;
+        }
+        if (arg == "--translate") {
+            setTranslationEnabled(true);
+        } else if (arg.compare(0, 14, "--memory-size=") == 0) {
+            try {
+                memorySize = stoull(arg.substr(14), nullptr, 0);
+            } catch (const exception& e) {
+                memorySize = 0;
+            }
+            if (memorySize == 0) {
+                cerr << LOG_ERROR << "Invalid memory size " << arg.substr(14) << endl;
+                return ERROR;
+            }
+        } else {
+            cerr << LOG_ERROR << "Unknown option " << argv[i] << endl;
+            return ERROR;
+        }
+    }
+
     auto baseFilename = getBaseFilename(argv[1]) + "_funct";
-    initSimulator(new MemoryStore(0, MEMORY_SIZE, argv[1]), baseFilename);
+    if (!checkpoints.restoreFile.empty()) {
+        cout << "[Simulator] Restoring checkpoint " << checkpoints.restoreFile << endl;
+        if (restoreSimulator(checkpoints.restoreFile, new MemoryStore(0, memorySize),
+                             baseFilename) != SUCCESS) {
+            return ERROR;
+        }
+    } else {
+        cout << "[Simulator] Loading memory from " << LOG_VAR(argv[1]) << endl;
+        initSimulator(new MemoryStore(0, memorySize, argv[1]), baseFilename);
+    }
 
     cout << "[Simulator] Start simulation" << endl;
-    auto status = runTillHalt();
+    Status status = runWithCheckpoints(checkpoints);
 
     cout << "[Simulator] Finished simulation status: " << status << endl;
     finalizeSimulator();
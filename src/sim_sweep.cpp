@@ -0,0 +1,323 @@
+/** NOTE design-space sweep driver
+ * Runs the cycle-accurate simulator on many (program, cache config) pairs in
+ * one process, spread over a pool of threads, and writes the statistics of
+ * all runs to a single CSV or JSON table. Every program image is loaded once
+ * and every run gets a copy-on-write clone of it.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cache.h"
+#include "MemoryStore.h"
+#include "Utilities.h"
+#include "cycle.h"
+
+using namespace std;
+
+// The caches of one cache_config.txt
+struct CacheSetup {
+    CacheConfig icConfig;
+    CacheConfig dcConfig;
+    std::vector<CacheConfig> lowerLevels;
+};
+
+struct SweepJob {
+    std::string program;
+    std::string cacheFile;
+    const CacheSetup* caches;
+    MemoryStore* memory;  // handed over to the simulator of the run
+};
+
+struct SweepResult {
+    Status status = ERROR;
+    SimulationStats stats{0, 0, 0, 0, 0, 0, 0};
+    PerfCounters perf;
+};
+
+struct SweepOptions {
+    uint64_t threads = 0;  // 0: one per hardware thread
+    uint64_t memorySize = MEMORY_SIZE;
+    uint64_t maxCycles = 0;  // 0: run till halt
+    std::string output = "sweep_results.csv";
+    bool json = false;
+};
+
+// read the "<file.bin> <cache_config.txt>" lines of the job list
+inline std::vector<std::pair<std::string, std::string>> readJobList(const std::string& jobFile) {
+    std::ifstream file(jobFile);
+    if (!file.is_open()) {
+        throw std::invalid_argument("Failed to open job list: " + jobFile);
+    }
+    std::vector<std::pair<std::string, std::string>> jobs;
+    std::string entry;
+    int line = 0;
+    while (std::getline(file, entry)) {
+        line++;
+        std::istringstream fields(entry.substr(0, entry.find('#')));
+        std::string program;
+        std::string cacheFile;
+        if (!(fields >> program)) {
+            continue;
+        }
+        if (!(fields >> cacheFile)) {
+            std::stringstream errorMessage;
+            errorMessage << "Expected <file.bin> <cache_config.txt> at line " << line << " of "
+                         << jobFile;
+            throw std::invalid_argument(errorMessage.str());
+        }
+        jobs.emplace_back(program, cacheFile);
+    }
+    return jobs;
+}
+
+inline SweepOptions parseArgs(int argc, char** argv, std::string& jobFile) {
+    if (argc < 2) {
+        std::cerr << LOG_ERROR << "Usage: " << argv[0] << " <jobs.txt>"
+                  << " [--threads=N] [--output=FILE] [--format=csv|json] [--memory-size=BYTES]"
+                  << " [--max-cycles=N]" << std::endl
+                  << "Note:" << std::endl
+                  << "Every \"<file.bin> <cache_config.txt>\" line of jobs.txt is simulated by the "
+                     "cycle-accurate simulator, '#' starts a comment. The runs are spread over "
+                     "--threads threads (default: one per hardware thread) and their statistics "
+                     "are written, in the order of jobs.txt, to one table (default "
+                     "sweep_results.csv). The format follows the extension of --output unless "
+                     "--format is given. No per-run output files are written."
+                  << std::endl
+                  << "--max-cycles stops runs that have not halted after N cycles, their status "
+                     "is cycle_limit."
+                  << std::endl;
+        exit(ERROR);
+    }
+
+    SweepOptions options;
+    std::string format;
+    try {
+        jobFile = argv[1];
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg.compare(0, 10, "--threads=") == 0) {
+                options.threads = std::stoull(arg.substr(10));
+            } else if (arg.compare(0, 9, "--output=") == 0) {
+                options.output = arg.substr(9);
+            } else if (arg.compare(0, 9, "--format=") == 0) {
+                format = arg.substr(9);
+                if (format != "csv" && format != "json") {
+                    throw std::invalid_argument("--format is csv or json, not " + format);
+                }
+            } else if (arg.compare(0, 14, "--memory-size=") == 0) {
+                options.memorySize = std::stoull(arg.substr(14), nullptr, 0);
+                if (options.memorySize == 0) {
+                    throw std::invalid_argument("--memory-size needs a non-zero size");
+                }
+            } else if (arg.compare(0, 13, "--max-cycles=") == 0) {
+                options.maxCycles = std::stoull(arg.substr(13));
+            } else {
+                throw std::invalid_argument("Unknown option " + arg);
+            }
+        }
+    } catch (const std::invalid_argument& e) {
+        std::cerr << LOG_ERROR << e.what() << std::endl;
+        exit(ERROR);
+    } catch (const std::out_of_range& e) {
+        std::cerr << LOG_ERROR << "One of the integer arguments is out of range." << std::endl;
+        exit(ERROR);
+    }
+
+    std::string extension = ".json";
+    bool jsonOutput = options.output.size() >= extension.size() &&
+                      options.output.compare(options.output.size() - extension.size(),
+                                             extension.size(), extension) == 0;
+    options.json = format.empty() ? jsonOutput : format == "json";
+    if (options.threads == 0) {
+        options.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return options;
+}
+
+// Simulate jobs until none are left, each worker on its own simulator. A run
+// with the same caches as the one before only resets them.
+static void runJobs(const std::vector<SweepJob>& jobs, std::vector<SweepResult>& results,
+                    std::atomic<size_t>& nextJob, uint64_t maxCycles) {
+    CycleSimulator simulator;
+    PipeTraceConfig traceConfig;
+    traceConfig.mode = TRACE_OFF;
+    simulator.setPipeTraceConfig(traceConfig);
+
+    const CacheSetup* lastCaches = nullptr;
+    for (size_t i = nextJob++; i < jobs.size(); i = nextJob++) {
+        const SweepJob& job = jobs[i];
+        Status status;
+        if (job.caches == lastCaches) {
+            status = simulator.reset(job.memory);
+        } else {
+            simulator.setLowerCacheLevels(job.caches->lowerLevels);
+            status = simulator.init(job.caches->icConfig, job.caches->dcConfig, job.memory, "");
+        }
+        lastCaches = status == SUCCESS ? job.caches : nullptr;
+        if (status != SUCCESS) {
+            continue;
+        }
+        results[i].status = simulator.runCycles(maxCycles);
+        results[i].stats = simulator.getSimulationStats();
+        results[i].perf = simulator.getPerfCounters();
+    }
+}
+
+static const char* statusName(Status status) {
+    switch (status) {
+        case HALT:
+            return "halt";
+        case SUCCESS:
+            return "cycle_limit";
+        default:
+            return "error";
+    }
+}
+
+static std::string jsonString(const std::string& text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+        }
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+// write the statistics of every run, in job order
+static Status writeResults(const SweepOptions& options, const std::vector<SweepJob>& jobs,
+                           const std::vector<SweepResult>& results) {
+    std::ofstream out(options.output);
+    if (!out) {
+        std::cerr << LOG_ERROR << "Could not open sweep results file!" << std::endl;
+        return ERROR;
+    }
+    static const char* const COLUMNS[] = {
+        "dynamic_instructions", "cycles",        "icache_hits",    "icache_misses",
+        "dcache_hits",          "dcache_misses", "load_use_stalls", "stall_cycles",
+        "branch_flushes"};
+
+    if (!options.json) {
+        out << "program,cache_config,status";
+        for (const char* column : COLUMNS) {
+            out << "," << column;
+        }
+        out << ",cpi" << std::endl;
+    } else {
+        out << "[" << std::endl;
+    }
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const SimulationStats& stats = results[i].stats;
+        const uint64_t values[] = {stats.dynamicInstructions, stats.totalCycles,
+                                   stats.icHits,              stats.icMisses,
+                                   stats.dcHits,              stats.dcMisses,
+                                   stats.loadUseStalls,       results[i].perf.stallCycles,
+                                   results[i].perf.branchFlushes};
+        if (!options.json) {
+            out << jobs[i].program << "," << jobs[i].cacheFile << ","
+                << statusName(results[i].status);
+            for (uint64_t value : values) {
+                out << "," << value;
+            }
+            out << "," << std::fixed << std::setprecision(3) << results[i].perf.cpi()
+                << std::endl;
+        } else {
+            out << "  {\"program\": " << jsonString(jobs[i].program)
+                << ", \"cache_config\": " << jsonString(jobs[i].cacheFile) << ", \"status\": \""
+                << statusName(results[i].status) << "\"";
+            for (size_t column = 0; column < sizeof(values) / sizeof(values[0]); column++) {
+                out << ", \"" << COLUMNS[column] << "\": " << values[column];
+            }
+            out << ", \"cpi\": " << std::fixed << std::setprecision(3) << results[i].perf.cpi()
+                << (i + 1 < jobs.size() ? "}," : "}") << std::endl;
+        }
+    }
+    if (options.json) {
+        out << "]" << std::endl;
+    }
+    return SUCCESS;
+}
+
+int main(int argc, char** argv) {
+    std::string jobFile;
+    SweepOptions options = parseArgs(argc, argv, jobFile);
+
+    // Load every program and parse every cache config once, however many
+    // runs share it
+    std::vector<std::pair<std::string, std::string>> jobList;
+    std::map<std::string, std::unique_ptr<MemoryStore>> images;
+    std::map<std::string, CacheSetup> cacheSetups;
+    try {
+        jobList = readJobList(jobFile);
+        for (const auto& entry : jobList) {
+            if (!images.count(entry.first)) {
+                std::unique_ptr<MemoryStore> image(new MemoryStore(0, options.memorySize));
+                if (image->loadFromFile(entry.first.c_str()) != SUCCESS) {
+                    return ERROR;
+                }
+                images[entry.first] = std::move(image);
+            }
+            if (!cacheSetups.count(entry.second)) {
+                CacheSetup& setup = cacheSetups[entry.second];
+                readCacheConfigFile(entry.second, setup.icConfig, setup.dcConfig,
+                                    setup.lowerLevels);
+            }
+        }
+    } catch (const std::invalid_argument& e) {
+        std::cerr << LOG_ERROR << e.what() << std::endl;
+        return ERROR;
+    } catch (const std::out_of_range& e) {
+        std::cerr << LOG_ERROR << "One of the cache config values is out of range." << std::endl;
+        return ERROR;
+    }
+
+    // Clone the images up front, clone() is not safe against concurrent clones
+    std::vector<SweepJob> jobs;
+    for (const auto& entry : jobList) {
+        jobs.push_back(SweepJob{entry.first, entry.second, &cacheSetups[entry.second],
+                                images[entry.first]->clone()});
+    }
+
+    uint64_t threadCount = std::min<uint64_t>(options.threads, std::max<size_t>(jobs.size(), 1));
+    cout << "[Sweep] Running " << jobs.size() << " simulations on " << threadCount
+         << " threads" << endl;
+    std::vector<SweepResult> results(jobs.size());
+    std::atomic<size_t> nextJob(0);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (uint64_t i = 0; i < threadCount; i++) {
+        workers.emplace_back(runJobs, std::cref(jobs), std::ref(results), std::ref(nextJob),
+                             options.maxCycles);
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    uint64_t totalCycles = 0;
+    bool failed = false;
+    for (const SweepResult& result : results) {
+        totalCycles += result.stats.totalCycles;
+        failed = failed || result.status == ERROR;
+    }
+    cout << "[Sweep] Finished in " << std::fixed << std::setprecision(3) << elapsed.count()
+         << " s, " << std::setprecision(1) << totalCycles / elapsed.count() / 1e6
+         << " M simulated cycles/s" << endl;
+    cout << "[Sweep] Writing " << (options.json ? "JSON" : "CSV") << " results to "
+         << options.output << endl;
+    if (writeResults(options, jobs, results) != SUCCESS) {
+        return ERROR;
+    }
+    return failed ? ERROR : SUCCESS;
+}
@@ -3,10 +3,19 @@
 #include <stdio.h>
 #include <iostream>
 #include <stdexcept>
+
+#include "checkpoint.h"
 using namespace std;
 
 #define EXCEPTION_HANDLER 0x8000
 
+// Instructions above this PC are decoded every time instead of cached. The
+// page table then holds at most 4096 pointers; the pages themselves only
+// exist for text that ran, at worst the whole 16 MB (about 370 MB decoded).
+#define DECODE_CACHE_LIMIT (1ULL << 24)
+
+static_assert(sizeof(Simulator::Instruction) <= 88, "pipeline latch layout grew");
+
 Simulator::Simulator() {
     // Initialize member variables
     memory = nullptr;
@@ -24,40 +33,151 @@ void Simulator::dumpRegMem(const std::string& output_name) {
     dumpMemoryState(memory, output_name);
 }
 
+void Simulator::saveCheckpoint(CheckpointWriter& writer) const {
+    writer.put<uint32_t>(CHECKPOINT_TAG_ARCH);
+    writer.put(din);
+    for (uint64_t reg : regData.registers) {
+        writer.put(reg);
+    }
+    memory->saveCheckpoint(writer);
+}
+
+// The memory is restored in place, into the one given to setMemory()
+void Simulator::restoreCheckpoint(CheckpointReader& reader) {
+    if (!memory) {
+        throw std::invalid_argument("Restoring a checkpoint needs a memory to restore into");
+    }
+    reader.expectTag(CHECKPOINT_TAG_ARCH);
+    din = reader.get<uint64_t>();
+    for (uint64_t& reg : regData.registers) {
+        reg = reader.get<uint64_t>();
+    }
+    memory->restoreCheckpoint(reader);
+    clearDecoded();
+}
+
+void Simulator::setDecodeCacheEnabled(bool enabled) {
+    decodeCacheEnabled = enabled;
+    clearDecoded();
+}
+
+void Simulator::clearDecoded() {
+    decodePages.clear();
+}
+
+// Look up the decoded form of the instruction at PC, nullptr if there is none
+const Simulator::Instruction* Simulator::lookupDecoded(uint64_t PC) const {
+    uint64_t index = PC >> 2;
+    uint64_t pageNum = index >> DECODE_PAGE_BITS;
+    if (!decodeCacheEnabled || (PC & 3) || pageNum >= decodePages.size() ||
+        !decodePages[pageNum]) {
+        return nullptr;
+    }
+    const DecodePage& page = *decodePages[pageNum];
+    uint64_t offset = index & (DECODE_PAGE_INSTRUCTIONS - 1);
+    return page.valid[offset] ? &page.insts[offset] : nullptr;
+}
+
+void Simulator::insertDecoded(const Instruction& inst) {
+    uint64_t index = inst.PC >> 2;
+    uint64_t pageNum = index >> DECODE_PAGE_BITS;
+    if (!decodeCacheEnabled || (inst.PC & 3) || inst.PC >= DECODE_CACHE_LIMIT) {
+        return;
+    }
+    if (pageNum >= decodePages.size()) {
+        decodePages.resize(pageNum + 1);
+    }
+    if (!decodePages[pageNum]) {
+        decodePages[pageNum].reset(new DecodePage());
+    }
+    uint64_t offset = index & (DECODE_PAGE_INSTRUCTIONS - 1);
+    decodePages[pageNum]->insts[offset] = inst;
+    decodePages[pageNum]->valid[offset] = true;
+}
+
+// Drop decoded instructions overlapping a store to [address, address + size)
+void Simulator::invalidateDecoded(uint64_t address, uint64_t size) {
+    uint64_t last = (address + size - 1) >> 2;
+    for (uint64_t index = address >> 2; index <= last; index++) {
+        uint64_t pageNum = index >> DECODE_PAGE_BITS;
+        if (pageNum >= decodePages.size()) {
+            break;
+        }
+        if (decodePages[pageNum]) {
+            decodePages[pageNum]->valid[index & (DECODE_PAGE_INSTRUCTIONS - 1)] = false;
+        }
+    }
+}
 
-// Get raw instruction bits from memory
-Simulator::Instruction Simulator::simFetch(uint64_t PC, MemoryStore *myMem) {
+// Get raw instruction bits from memory into a fresh instruction
+void Simulator::simFetch(uint64_t PC, MemoryStore *myMem, Instruction& inst) {
     // fetch current instruction
     uint64_t instruction;
     myMem->getMemValue(PC, instruction, WORD_SIZE);
-    instruction = (uint32_t)instruction;
 
-    Instruction inst;
+    inst = Instruction();
     inst.PC = PC;
-    inst.instruction = instruction;
-    return inst;
+    inst.instruction = (uint32_t)instruction;
+}
+
+// Extract and sign-extend the immediate for the format used by opcode
+static uint64_t decodeImmediate(uint64_t instruction, uint64_t opcode) {
+    uint64_t imm5   = extractBits(instruction, 11, 7);
+    uint64_t imm7   = extractBits(instruction, 31, 25);
+    uint64_t imm12  = extractBits(instruction, 31, 20);
+    uint64_t imm20  = extractBits(instruction, 31, 12);
+
+    switch (opcode) {
+        case OP_LOAD:
+        case OP_INTIMM:
+        case OP_INTIMMW:
+        case OP_JALR:
+            return sext64(imm12, 11); // I-type immediate
+        case OP_STORE:
+            return sext64((imm7 << 5) | imm5, 11); // S-type immediate
+        case OP_BRANCH:
+            return sext64(
+                extractBits(imm7, 6, 6) << 12 |
+                extractBits(imm7, 5, 0) << 5 |
+                extractBits(imm5, 4, 1) << 1 |
+                extractBits(imm5, 0, 0) << 11,
+                12); // B-type immediate
+        case OP_JAL:
+            return sext64(
+                extractBits(imm20, 19, 19) << 20 |
+                extractBits(imm20, 18, 9) << 1 |
+                extractBits(imm20, 8, 8) << 11 |
+                extractBits(imm20, 7, 0) << 12,
+                20); // J-type immediate
+        case OP_AUIPC:
+        case OP_LUI:
+            return sext64(imm20 << 12, 31); // U-type immediate
+        default:
+            return 0;
+    }
 }
 
-// Determine instruction opcode, funct, reg names (but not calculate all imms)
-Simulator::Instruction Simulator::simDecode(Instruction inst) {
+// Determine instruction opcode, funct, reg names and immediate
+void Simulator::simDecode(Instruction& inst) {
     inst.opcode = extractBits(inst.instruction, 6, 0);
     inst.rd     = extractBits(inst.instruction, 11, 7);
     inst.funct3 = extractBits(inst.instruction, 14, 12);
     inst.rs1    = extractBits(inst.instruction, 19, 15);
     inst.rs2    = extractBits(inst.instruction, 24, 20);
     inst.funct7 = extractBits(inst.instruction, 31, 25);
+    inst.imm    = decodeImmediate(inst.instruction, inst.opcode);
 
     inst.isLegal = true;
 
     // Halt instruction
     if (inst.instruction == 0xfeedfeed) {
         inst.isHalt = true;
-        return inst; 
+        return;
     }
     // NOP instruction
     if (inst.instruction == 0x00000013) {
         inst.isNop = true;
-        return inst; 
+        return;
     }
 
     switch (inst.opcode) {
@@ -157,44 +277,26 @@ Simulator::Instruction Simulator::simDecode(Instruction inst) {
         default:
             inst.isLegal = false;
     }
-    return inst;
 }
 
 // Collect operands whether reg or imm for arith or addr gen
-Simulator::Instruction Simulator::simOperandCollection(Instruction inst, REGS regData) {
-    regData.registers[0] = 0;
+void Simulator::simOperandCollection(Instruction& inst, const REGS& regData) {
+    // x0 may have been written by simCommit, it always reads as 0
     if (inst.readsRs1) {
-        inst.op1Val = regData.registers[inst.rs1];
+        inst.op1Val = inst.rs1 ? regData.registers[inst.rs1] : 0;
     }
     if (inst.readsRs2) {
-        inst.op2Val = regData.registers[inst.rs2];
+        inst.op2Val = inst.rs2 ? regData.registers[inst.rs2] : 0;
     }
-    return inst;
 }
 
 // Resolve next PC whether +4 or branch/jump target taken/not taken
-Simulator::Instruction Simulator::simNextPCResolution(Instruction inst) {
-
-    uint64_t imm5   = inst.rd;
-    uint64_t imm7   = inst.funct7;
-    uint64_t imm12  = extractBits(inst.instruction, 31, 20);
-    uint64_t imm20  = extractBits(inst.instruction, 31, 12);
-    uint64_t branchTarget = inst.PC + sext64(
-        extractBits(imm7, 6, 6) << 12 |
-        extractBits(imm7, 5, 0) << 5 |
-        extractBits(imm5, 4, 1) << 1 |
-        extractBits(imm5, 0, 0) << 11,
-        12); // B-type immediate
-    uint64_t jalTarget = inst.PC + sext64(
-        extractBits(imm20, 19, 19) << 20 |
-        extractBits(imm20, 18, 9) << 1 |
-        extractBits(imm20, 8, 8) << 11 |
-        extractBits(imm20, 7, 0) << 12,
-        20); // J-type immediate
+void Simulator::simNextPCResolution(Instruction& inst) {
+    uint64_t branchTarget = inst.PC + inst.imm;
 
     switch (inst.opcode) {
         case OP_JALR:
-            inst.nextPC = (inst.op1Val + sext64(imm12, 11)) & ~1ULL;
+            inst.nextPC = (inst.op1Val + inst.imm) & ~1ULL;
             break;
         case OP_BRANCH:
             inst.nextPC = inst.PC + 4;
@@ -232,20 +334,16 @@ Simulator::Instruction Simulator::simNextPCResolution(Instruction inst) {
             }
             break;
         case OP_JAL:
-            inst.nextPC = jalTarget;
+            inst.nextPC = inst.PC + inst.imm;
             break;
         default:
             inst.nextPC = inst.PC + 4;
     }
-
-    return inst;
 }
 
 // Perform arithmetic operations
-Simulator::Instruction Simulator::simArithLogic(Instruction inst) {
-    uint64_t imm12  = extractBits(inst.instruction, 31, 20);
-    uint64_t upperImm12 = extractBits(inst.instruction, 31, 26);
-    uint64_t imm20  = extractBits(inst.instruction, 31, 12);
+void Simulator::simArithLogic(Instruction& inst) {
+    uint64_t upperImm12 = inst.funct7 >> 1;
 
     if (inst.opcode == OP_INT && (
         inst.funct3 == FUNCT3_SLL || inst.funct3 == FUNCT3_SR)) {
@@ -322,48 +420,48 @@ Simulator::Instruction Simulator::simArithLogic(Instruction inst) {
         case OP_INTIMM:
             switch (inst.funct3) {
                 case FUNCT3_ADD:
-                    inst.arithResult = inst.op1Val + sext64(imm12, 11);
+                    inst.arithResult = inst.op1Val + inst.imm;
                     break;
                 case FUNCT3_SLL:
-                    inst.arithResult = inst.op1Val << (imm12 & 0x3F);
+                    inst.arithResult = inst.op1Val << (inst.imm & 0x3F);
                     break;
                 case FUNCT3_SLT:
-                    inst.arithResult = (int64_t)inst.op1Val < (int64_t)sext64(imm12, 11);
+                    inst.arithResult = (int64_t)inst.op1Val < (int64_t)inst.imm;
                     break;
                 case FUNCT3_SLTU:
-                    inst.arithResult = inst.op1Val < sext64(imm12, 11);
+                    inst.arithResult = inst.op1Val < inst.imm;
                     break;
                 case FUNCT3_XOR:
-                    inst.arithResult = inst.op1Val ^ sext64(imm12, 11);
+                    inst.arithResult = inst.op1Val ^ inst.imm;
                     break;
                 case FUNCT3_SR:
                     if (upperImm12 == UPPERIMM_LOGICAL) {
-                        inst.arithResult = inst.op1Val >> (imm12 & 0x3F);
+                        inst.arithResult = inst.op1Val >> (inst.imm & 0x3F);
                     } else if (upperImm12 == UPPERIMM_ARITH) {
-                        inst.arithResult = (int64_t)inst.op1Val >> (imm12 & 0x3F);
+                        inst.arithResult = (int64_t)inst.op1Val >> (inst.imm & 0x3F);
                     }
                     break;
                 case FUNCT3_OR:
-                    inst.arithResult = inst.op1Val | sext64(imm12, 11);
+                    inst.arithResult = inst.op1Val | inst.imm;
                     break;
                 case FUNCT3_AND:
-                    inst.arithResult = inst.op1Val & sext64(imm12, 11);
+                    inst.arithResult = inst.op1Val & inst.imm;
                     break;
             }
             break;
         case OP_INTIMMW:
             switch (inst.funct3) {
                 case FUNCT3_ADD:
-                    inst.arithResult = sext64((uint32_t)inst.op1Val + (uint32_t)sext32(imm12, 11), 31);
+                    inst.arithResult = sext64((uint32_t)inst.op1Val + (uint32_t)inst.imm, 31);
                     break;
                 case FUNCT3_SLL:
-                    inst.arithResult = sext64((uint32_t)inst.op1Val << (uint32_t)(imm12 & 0x1F), 31);
+                    inst.arithResult = sext64((uint32_t)inst.op1Val << (uint32_t)(inst.imm & 0x1F), 31);
                     break;
                 case FUNCT3_SR:
                     if (upperImm12 == UPPERIMM_LOGICAL) {
-                        inst.arithResult = sext64((uint32_t)inst.op1Val >> (uint32_t)(imm12 & 0x1F), 31);
+                        inst.arithResult = sext64((uint32_t)inst.op1Val >> (uint32_t)(inst.imm & 0x1F), 31);
                     } else if (upperImm12 == UPPERIMM_ARITH) {
-                        inst.arithResult = sext64((int32_t)inst.op1Val >> (uint32_t)(imm12 & 0x1F), 31);
+                        inst.arithResult = sext64((int32_t)inst.op1Val >> (uint32_t)(inst.imm & 0x1F), 31);
                     }
                     break;
             }
@@ -372,44 +470,33 @@ Simulator::Instruction Simulator::simArithLogic(Instruction inst) {
             inst.arithResult = inst.PC + 4;
             break;
         case OP_AUIPC:
-            inst.arithResult = inst.PC + sext64(imm20 << 12, 31);
+            inst.arithResult = inst.PC + inst.imm;
             break;
         case OP_LUI:
-            inst.arithResult = sext64(imm20 << 12, 31);
+            inst.arithResult = inst.imm;
             break;
         case OP_JAL:
             inst.arithResult = inst.PC + 4;
             break;
     }
-
-    return inst;
 }
 
 // Generate memory address for load/store instructions
-Simulator::Instruction Simulator::simAddrGen(Instruction inst) {
-    uint64_t imm5   = inst.rd;
-    uint64_t imm7   = inst.funct7;
-    uint64_t imm12  = extractBits(inst.instruction, 31, 20);
-    int64_t storeImm = sext64((imm7 << 5) | imm5, 11); // S-type immediate
-
-    if (inst.readsMem) {
-        inst.memAddress = inst.op1Val + sext64(imm12, 11);
-    } else if (inst.writesMem) {
-        inst.memAddress = inst.op1Val + storeImm;
+void Simulator::simAddrGen(Instruction& inst) {
+    if (inst.readsMem || inst.writesMem) {
+        inst.memAddress = inst.op1Val + inst.imm;
     }
-
-    return inst;
 }
 
 // Perform memory access for load/store instructions
-Simulator::Instruction Simulator::simMemAccess(Instruction inst, MemoryStore *myMem) {
+void Simulator::simMemAccess(Instruction& inst, MemoryStore *myMem) {
     MemEntrySize size = (inst.funct3 == FUNCT3_B || inst.funct3 == FUNCT3_BU) ? BYTE_SIZE :
                     (inst.funct3 == FUNCT3_H || inst.funct3 == FUNCT3_HU) ? HALF_SIZE :
                     (inst.funct3 == FUNCT3_W || inst.funct3 == FUNCT3_WU) ? WORD_SIZE : DOUBLE_SIZE;
 
     if (inst.readsMem) {
         uint64_t value;
-        myMem->getMemValue(inst.memAddress, value, size);
+        inst.memException = myMem->getMemValue(inst.memAddress, value, size) != 0;
 
         if (inst.funct3 == FUNCT3_B || inst.funct3 == FUNCT3_H || inst.funct3 == FUNCT3_W) {
             inst.memResult = sext64(value, size * 8 - 1);
@@ -417,86 +504,119 @@ Simulator::Instruction Simulator::simMemAccess(Instruction inst, MemoryStore *my
             inst.memResult = value;
         }
     } else if (inst.writesMem) {
-        myMem->setMemValue(inst.memAddress, inst.op2Val, size);
+        inst.memException = myMem->setMemValue(inst.memAddress, inst.op2Val, size) != 0;
+        invalidateDecoded(inst.memAddress, size);
     }
-
-    return inst;
 }
 
 // Write back results to registers
-Simulator::Instruction Simulator::simCommit(Instruction inst, REGS &regData) {
+void Simulator::simCommit(const Instruction& inst, REGS &regData) {
     if (inst.readsMem) {
         regData.registers[inst.rd] = inst.memResult;
     } else {
         regData.registers[inst.rd] = inst.arithResult;
     }
-    return inst;
 }
 
 // TODO complete the following pipeline stage simulation functions
 // You may find it useful to call functional simulation functions above
+// The stages update the pipeline latch they are given in place.
 
-Simulator::Instruction Simulator::simIF(uint64_t PC) {
+void Simulator::simIF(uint64_t PC, Instruction& inst) {
     // throw std::runtime_error("simIF not implemented yet"); // TODO implement IF
-    Instruction inst = simFetch(PC, memory);
+    simFetch(PC, memory, inst);
     // inst.instructionID = din++;
-    return inst;
 }
 
-Simulator::Instruction Simulator::simID(Simulator::Instruction inst) {
+void Simulator::simID(Instruction& inst) {
     // throw std::runtime_error("simID not implemented yet"); // TODO implement ID
-    inst = simDecode(inst);
+    const Instruction* decoded = lookupDecoded(inst.PC);
+    if (decoded && decoded->instruction == inst.instruction) {
+        StageStatus status = inst.status;
+        inst = *decoded;
+        inst.status = status;
+    } else {
+        simDecode(inst);
+        insertDecoded(inst);
+    }
     inst.instructionID = din++;
     if (!inst.isLegal || inst.isHalt) {
-        return inst;
+        // Fetch carries on sequentially; an illegal instruction traps later
+        inst.nextPC = inst.PC + 4;
+        return;
     }
-    inst = simOperandCollection(inst, regData);
-    inst = simNextPCResolution(inst);
-    return inst;
+    simOperandCollection(inst, regData);
+    simNextPCResolution(inst);
 }
 
-Simulator::Instruction Simulator::simEX(Simulator::Instruction inst) {
+void Simulator::simEX(Instruction& inst) {
     // throw std::runtime_error("simEX not implemented yet"); // TODO implement EX
     if (inst.doesArithLogic) {
-        inst = simArithLogic(inst);
+        simArithLogic(inst);
     }
     if (inst.readsMem || inst.writesMem) {
-        inst = simAddrGen(inst);
+        simAddrGen(inst);
     }
-    return inst;
 }
 
-Simulator::Instruction Simulator::simMEM(Simulator::Instruction inst) {
+void Simulator::simMEM(Instruction& inst) {
     // throw std::runtime_error("simMEM not implemented yet"); // TODO implement MEM
     if (inst.readsMem || inst.writesMem) {
-        inst = simMemAccess(inst, memory);
+        simMemAccess(inst, memory);
     }
-    return inst;
 }
 
-Simulator::Instruction Simulator::simWB(Simulator::Instruction inst) {
+void Simulator::simWB(Instruction& inst) {
     // throw std::runtime_error("simWB not implemented yet"); // TODO implement WB
     if (inst.writesRd) {
-        inst = simCommit(inst, regData);
+        simCommit(inst, regData);
+    }
+}
+
+// Fetch and decode the instruction at PC, reusing an earlier decode if the
+// word has not been written since
+void Simulator::simFetchDecode(uint64_t PC, Instruction& inst) {
+    const Instruction* decoded = lookupDecoded(PC);
+    if (decoded) {
+        inst = *decoded;
+    } else {
+        simFetch(PC, memory, inst);
+        simDecode(inst);
+        insertDecoded(inst);
     }
-    return inst;
 }
 
 // Simulate the whole instruction using functions above
 Simulator::Instruction Simulator::simInstruction(uint64_t PC) {
     // Implementation moved from .cpp to .h for illustration
-    Instruction inst = simFetch(PC, memory);
-    inst = simDecode(inst);
+    Instruction inst;
+    simFetchDecode(PC, inst);
     inst.instructionID = din++;
     if (!inst.isLegal || inst.isHalt) return inst;
-    inst = simOperandCollection(inst, regData);
-    inst = simNextPCResolution(inst);
-    if (inst.doesArithLogic) inst = simArithLogic(inst);
+    simOperandCollection(inst, regData);
+    simNextPCResolution(inst);
+    if (inst.doesArithLogic) simArithLogic(inst);
     if (inst.readsMem || inst.writesMem) {
-        inst = simAddrGen(inst);
-        inst = simMemAccess(inst, memory);
+        simAddrGen(inst);
+        simMemAccess(inst, memory);
     }
-    if (inst.writesRd) inst = simCommit(inst, regData);
-    PC = inst.nextPC;
+    if (inst.writesRd) simCommit(inst, regData);
     return inst;
-}
\ No newline at end of file
+}
+
+bool Simulator::simInstructionUnlessTrap(uint64_t PC, Instruction& inst) {
+    simFetchDecode(PC, inst);
+    if (!inst.isLegal || inst.isHalt) return false;
+    simOperandCollection(inst, regData);
+    simNextPCResolution(inst);
+    if (inst.doesArithLogic) simArithLogic(inst);
+    if (inst.readsMem || inst.writesMem) {
+        simAddrGen(inst);
+        // A faulting access neither reads nor writes memory
+        simMemAccess(inst, memory);
+        if (inst.memException) return false;
+    }
+    if (inst.writesRd) simCommit(inst, regData);
+    inst.instructionID = din++;
+    return true;
+}
@@ -1,12 +1,20 @@
 #pragma once
 
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "Utilities.h"
 #include "MemoryStore.h"
 #include "RegisterInfo.h"
 
+class CheckpointWriter;
+class CheckpointReader;
+
 class Simulator {
+    // The translated execution engine works on the registers directly
+    friend class Translator;
+
    private:
     union REGS {
         RegisterInfo reg;
@@ -25,78 +33,137 @@ class Simulator {
     Simulator();
     ~Simulator();
 
+    // Pipeline latch. Decode fields are narrowed to their encoded widths and
+    // the flags are packed into bit-fields, so that one latch is 88 bytes
+    // and the five latches plus doneInst fit in nine cache lines.
     struct Instruction {
         // known by IF
         uint64_t PC = 0;
-        uint64_t instruction = 0;    // raw instruction encoding
+        uint32_t instruction = 0;    // raw instruction encoding
 
         // known by ID
-        bool     isHalt = false;
-        bool     isLegal = false;
-        bool     isNop = false;
-
-        bool     readsMem = false;
-        bool     writesMem = false;
-        bool     doesArithLogic = false;
-        bool     writesRd = false;
-        bool     readsRs1 = false;
-        bool     readsRs2 = false;
-
-        uint64_t opcode = 0;
-        uint64_t funct3 = 0;
-        uint64_t funct7 = 0;
-        uint64_t rd = 0;
-        uint64_t rs1 = 0;
-        uint64_t rs2 = 0;
+        uint8_t  opcode = 0;
+        uint8_t  funct3 = 0;
+        uint8_t  funct7 = 0;
+        uint8_t  rd = 0;
+        uint8_t  rs1 = 0;
+        uint8_t  rs2 = 0;
+
+        bool     isHalt : 1;
+        bool     isLegal : 1;
+        bool     isNop : 1;
+
+        bool     readsMem : 1;
+        bool     writesMem : 1;
+        bool     doesArithLogic : 1;
+        bool     writesRd : 1;
+        bool     readsRs1 : 1;
+        bool     readsRs2 : 1;
+
+        // known by MEM
+        bool     memException : 1;
+
+        // Set on the NOPs the pipeline inserts, as opposed to NOPs in the program
+        bool     isBubble : 1;
 
+        // Used for stage status tracking in cycle
+        StageStatus status : 8;
+
+        uint64_t imm = 0;            // sign-extended immediate of any format
         uint64_t nextPC = 0;
 
         uint64_t op1Val = 0;
         uint64_t op2Val = 0;
 
-
         // known by EX
         uint64_t arithResult = 0;
         uint64_t memAddress = 0;
 
         // known by MEM
-        bool     memException = false;
         uint64_t memResult = 0;
-        uint64_t valToWrite = 0;
 
         // known by WB
         uint64_t instructionID = 0;
 
-        // Used for stage status tracking in cycle
-        StageStatus status = NORMAL;
+        // Bit-fields cannot have default member initializers before C++20
+        Instruction()
+            : isHalt(false),
+              isLegal(false),
+              isNop(false),
+              readsMem(false),
+              writesMem(false),
+              doesArithLogic(false),
+              writesRd(false),
+              readsRs1(false),
+              readsRs2(false),
+              memException(false),
+              isBubble(false),
+              status(NORMAL) {}
     };
 
+   private:
+    // Pre-decoded instructions, filled on first fetch and invalidated by
+    // stores into decoded words. They are kept in pages of 1024 instructions
+    // (4 KB of text, about 90 KB decoded), allocated on first use, so the
+    // footprint follows the code that runs rather than its highest PC.
+    static constexpr uint64_t DECODE_PAGE_BITS = 10;
+    static constexpr uint64_t DECODE_PAGE_INSTRUCTIONS = 1ULL << DECODE_PAGE_BITS;
+    struct DecodePage {
+        Instruction insts[DECODE_PAGE_INSTRUCTIONS];
+        bool valid[DECODE_PAGE_INSTRUCTIONS] = {};
+    };
+    // Indexed by PC / 4 / DECODE_PAGE_INSTRUCTIONS, nullptr for pages not
+    // decoded from yet
+    std::vector<std::unique_ptr<DecodePage>> decodePages;
+    bool decodeCacheEnabled = true;
+
+    const Instruction* lookupDecoded(uint64_t PC) const;
+    void insertDecoded(const Instruction& inst);
+    void invalidateDecoded(uint64_t address, uint64_t size);
+    void clearDecoded();
+
+   public:
+
     // getters and setters
     auto getDin() { return din; }
     auto getMemory() { return memory; }
 
     void setMemory(MemoryStore* mem) { memory = mem; }
+    void setDecodeCacheEnabled(bool enabled);
+
+    // Simulate by functionality (project 1), updating inst in place
+    void simFetch(uint64_t PC, MemoryStore *myMem, Instruction& inst);
+    void simDecode(Instruction& inst);
+    void simOperandCollection(Instruction& inst, const REGS& regData);
+    void simNextPCResolution(Instruction& inst);
+    void simArithLogic(Instruction& inst);
+    void simAddrGen(Instruction& inst);
+    void simMemAccess(Instruction& inst, MemoryStore *myMem);
+    void simCommit(const Instruction& inst, REGS &regData);
 
-    // Simulate by functionality (project 1)
-    Instruction simFetch(uint64_t PC, MemoryStore *myMem);
-    Instruction simDecode(Instruction inst);
-    Instruction simOperandCollection(Instruction inst, REGS regData);
-    Instruction simNextPCResolution(Instruction inst);
-    Instruction simArithLogic(Instruction inst);
-    Instruction simAddrGen(Instruction inst);
-    Instruction simMemAccess(Instruction inst, MemoryStore *myMem);
-    Instruction simCommit(Instruction inst, REGS &regData);
+    // Fetch and decode, going through the pre-decoded instruction cache
+    void simFetchDecode(uint64_t PC, Instruction& inst);
 
     // Simulate instruction
     Instruction simInstruction(uint64_t PC);
 
-    // Simulate pipeline stages
-    Instruction simIF(uint64_t PC);
-    Instruction simID(Instruction inst);
-    Instruction simEX(Instruction inst);
-    Instruction simMEM(Instruction inst);
-    Instruction simWB(Instruction inst);
+    // Simulate the instruction at PC like simInstruction(), unless it is the
+    // halt or traps (an illegal instruction or a memory fault): then return
+    // false and leave the registers, memory and instruction count untouched
+    bool simInstructionUnlessTrap(uint64_t PC, Instruction& inst);
+
+    // Simulate pipeline stages, each one updates its pipeline latch in place
+    void simIF(uint64_t PC, Instruction& inst);
+    void simID(Instruction& inst);
+    void simEX(Instruction& inst);
+    void simMEM(Instruction& inst);
+    void simWB(Instruction& inst);
 
     // Helper function to dump registers and memory
     void dumpRegMem(const std::string& output_name);
+
+    // Write the dynamic instruction count, registers and memory to a
+    // checkpoint, and read them back (throws std::invalid_argument)
+    void saveCheckpoint(CheckpointWriter& writer) const;
+    void restoreCheckpoint(CheckpointReader& reader);
 };
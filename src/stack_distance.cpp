@@ -0,0 +1,86 @@
+#include "stack_distance.h"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <utility>
+
+using namespace std;
+
+static bool isPowerOfTwo(uint64_t value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+/** Histogram of per-set LRU stack distances, depths of maxDepth and beyond
+ * (including first references) land in histogram[maxDepth]
+ * @param
+ *      blockBits, sets: block offset width and set count (a power of two)
+ *      maxDepth: deepest stack position of interest, the largest associativity
+ */
+static vector<uint64_t> stackDistances(const vector<uint64_t>& addresses, uint64_t blockBits,
+                                       uint64_t sets, uint64_t maxDepth) {
+    vector<uint64_t> histogram(maxDepth + 1, 0);
+    // The stacks of all sets, most recently used block first; the stack of
+    // each set only holds the maxDepth blocks that can still hit
+    vector<uint64_t> stacks(sets * maxDepth);
+    vector<uint64_t> depths(sets, 0);
+
+    for (uint64_t address : addresses) {
+        uint64_t block = address >> blockBits;
+        uint64_t set = block & (sets - 1);
+        uint64_t* stack = &stacks[set * maxDepth];
+        uint64_t depth = depths[set];
+
+        uint64_t distance = 0;
+        while (distance < depth && stack[distance] != block) {
+            distance++;
+        }
+        histogram[distance == depth ? maxDepth : distance]++;
+
+        // Move the block to the top, dropping the bottom of a full stack
+        if (distance == depth && depth < maxDepth) {
+            depths[set] = depth + 1;
+        } else if (distance == depth) {
+            distance = maxDepth - 1;
+        }
+        copy_backward(stack, stack + distance, stack + distance + 1);
+        stack[0] = block;
+    }
+    return histogram;
+}
+
+Status sweepLruCaches(const vector<uint64_t>& addresses, vector<SweepPoint>& points) {
+    // Points that share a block size and set count come out of one histogram
+    map<pair<uint64_t, uint64_t>, vector<SweepPoint*>> groups;
+    for (SweepPoint& point : points) {
+        uint64_t lineBytes = point.blockSize * point.ways;
+        if (!isPowerOfTwo(point.blockSize) || point.ways == 0 || point.cacheSize % lineBytes != 0 ||
+            !isPowerOfTwo(point.cacheSize / lineBytes)) {
+            cerr << LOG_ERROR << "Cannot sweep a " << point.cacheSize << " byte cache of "
+                 << point.ways << " ways of " << point.blockSize
+                 << " byte blocks: sets and block size must be powers of two" << endl;
+            return ERROR;
+        }
+        groups[make_pair(point.blockSize, point.cacheSize / lineBytes)].push_back(&point);
+    }
+
+    for (const auto& group : groups) {
+        uint64_t blockBits = 0;
+        while ((1ULL << blockBits) < group.first.first) blockBits++;
+        uint64_t maxWays = 0;
+        for (const SweepPoint* point : group.second) {
+            maxWays = max(maxWays, point->ways);
+        }
+
+        vector<uint64_t> histogram =
+            stackDistances(addresses, blockBits, group.first.second, maxWays);
+        for (SweepPoint* point : group.second) {
+            point->hits = 0;
+            for (uint64_t distance = 0; distance < point->ways; distance++) {
+                point->hits += histogram[distance];
+            }
+            point->misses = addresses.size() - point->hits;
+        }
+    }
+    return SUCCESS;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <inttypes.h>
+
+#include <vector>
+
+#include "Utilities.h"
+
+// One cache geometry of a sweep, and the hits and misses that a true-LRU,
+// write-allocate cache of that geometry has on the analysed address stream
+struct SweepPoint {
+    uint64_t cacheSize;
+    uint64_t blockSize;
+    uint64_t ways;
+    uint64_t hits;
+    uint64_t misses;
+};
+
+/** Mattson stack-distance analysis. An LRU set of A ways hits exactly when
+ * the block is among the A most recently used blocks of its set, so one pass
+ * over the stream per distinct (block size, set count) yields the hits of
+ * every associativity at once.
+ * @return ERROR, with a message on cerr, if a point does not divide into a
+ *         power-of-two number of sets and a power-of-two block size
+ * @param
+ *      addresses: the addresses in the order they reach the cache
+ *      points: geometries to evaluate, their hits and misses are filled in
+ */
+Status sweepLruCaches(const std::vector<uint64_t>& addresses, std::vector<SweepPoint>& points);
@@ -0,0 +1,430 @@
+#include "translate.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+typedef Translator::Context Context;
+typedef Translator::Op Op;
+
+// Register-register operations
+#define R_HANDLER(name, expr)                                  \
+    static uint64_t name(Context& ctx, const Op& op) {         \
+        uint64_t a = ctx.regs[op.rs1];                         \
+        uint64_t b = ctx.regs[op.rs2];                         \
+        ctx.regs[op.rd] = (expr);                              \
+        return op.PC + 4;                                      \
+    }
+
+// Register-immediate operations
+#define I_HANDLER(name, expr)                                  \
+    static uint64_t name(Context& ctx, const Op& op) {         \
+        uint64_t a = ctx.regs[op.rs1];                         \
+        uint64_t imm = op.imm;                                 \
+        ctx.regs[op.rd] = (expr);                              \
+        return op.PC + 4;                                      \
+    }
+
+// Loads, sign-extending from signBit (or not at all when signBit < 0)
+#define LOAD_HANDLER(name, size, signBit)                                      \
+    static uint64_t name(Context& ctx, const Op& op) {                         \
+        uint64_t value;                                                        \
+        ctx.memory->getMemValue(ctx.regs[op.rs1] + op.imm, value, size);       \
+        ctx.regs[op.rd] = (signBit) >= 0 ? sext64(value, signBit) : value;     \
+        return op.PC + 4;                                                      \
+    }
+
+// Stores into translated code are caught by the memory write watch
+#define STORE_HANDLER(name, size)                                              \
+    static uint64_t name(Context& ctx, const Op& op) {                         \
+        ctx.memory->setMemValue(ctx.regs[op.rs1] + op.imm, ctx.regs[op.rs2], size); \
+        return op.PC + 4;                                                      \
+    }
+
+// Conditional branches
+#define B_HANDLER(name, cond)                                  \
+    static uint64_t name(Context& ctx, const Op& op) {         \
+        uint64_t a = ctx.regs[op.rs1];                         \
+        uint64_t b = ctx.regs[op.rs2];                         \
+        return (cond) ? op.PC + op.imm : op.PC + 4;            \
+    }
+
+R_HANDLER(opAdd, a + b)
+R_HANDLER(opSub, a - b)
+R_HANDLER(opSll, a << (b & 0x3F))
+R_HANDLER(opSlt, (int64_t)a < (int64_t)b)
+R_HANDLER(opSltu, a < b)
+R_HANDLER(opXor, a ^ b)
+R_HANDLER(opSrl, a >> (b & 0x3F))
+R_HANDLER(opSra, (int64_t)a >> (b & 0x3F))
+R_HANDLER(opOr, a | b)
+R_HANDLER(opAnd, a & b)
+
+R_HANDLER(opAddw, sext64((uint32_t)a + (uint32_t)b, 31))
+R_HANDLER(opSubw, sext64((uint32_t)a - (uint32_t)b, 31))
+R_HANDLER(opSllw, sext64((uint32_t)a << (uint32_t)(b & 0x1F), 31))
+R_HANDLER(opSrlw, sext64((uint32_t)a >> (uint32_t)(b & 0x1F), 31))
+R_HANDLER(opSraw, sext64((int32_t)a >> (uint32_t)(b & 0x1F), 31))
+
+I_HANDLER(opAddi, a + imm)
+I_HANDLER(opSlli, a << (imm & 0x3F))
+I_HANDLER(opSlti, (int64_t)a < (int64_t)imm)
+I_HANDLER(opSltiu, a < imm)
+I_HANDLER(opXori, a ^ imm)
+I_HANDLER(opSrli, a >> (imm & 0x3F))
+I_HANDLER(opSrai, (int64_t)a >> (imm & 0x3F))
+I_HANDLER(opOri, a | imm)
+I_HANDLER(opAndi, a & imm)
+
+I_HANDLER(opAddiw, sext64((uint32_t)a + (uint32_t)imm, 31))
+I_HANDLER(opSlliw, sext64((uint32_t)a << (uint32_t)(imm & 0x1F), 31))
+I_HANDLER(opSrliw, sext64((uint32_t)a >> (uint32_t)(imm & 0x1F), 31))
+I_HANDLER(opSraiw, sext64((int32_t)a >> (uint32_t)(imm & 0x1F), 31))
+
+LOAD_HANDLER(opLb, BYTE_SIZE, 7)
+LOAD_HANDLER(opLh, HALF_SIZE, 15)
+LOAD_HANDLER(opLw, WORD_SIZE, 31)
+LOAD_HANDLER(opLd, DOUBLE_SIZE, -1)
+LOAD_HANDLER(opLbu, BYTE_SIZE, -1)
+LOAD_HANDLER(opLhu, HALF_SIZE, -1)
+LOAD_HANDLER(opLwu, WORD_SIZE, -1)
+
+STORE_HANDLER(opSb, BYTE_SIZE)
+STORE_HANDLER(opSh, HALF_SIZE)
+STORE_HANDLER(opSw, WORD_SIZE)
+STORE_HANDLER(opSd, DOUBLE_SIZE)
+
+B_HANDLER(opBeq, a == b)
+B_HANDLER(opBne, a != b)
+B_HANDLER(opBlt, (int64_t)a < (int64_t)b)
+B_HANDLER(opBge, (int64_t)a >= (int64_t)b)
+B_HANDLER(opBltu, a < b)
+B_HANDLER(opBgeu, a >= b)
+
+static uint64_t opLui(Context& ctx, const Op& op) {
+    ctx.regs[op.rd] = op.imm;
+    return op.PC + 4;
+}
+
+static uint64_t opAuipc(Context& ctx, const Op& op) {
+    ctx.regs[op.rd] = op.PC + op.imm;
+    return op.PC + 4;
+}
+
+static uint64_t opJal(Context& ctx, const Op& op) {
+    ctx.regs[op.rd] = op.PC + 4;
+    return op.PC + op.imm;
+}
+
+static uint64_t opJalr(Context& ctx, const Op& op) {
+    // rd may be rs1, so resolve the target first
+    uint64_t target = (ctx.regs[op.rs1] + op.imm) & ~1ULL;
+    ctx.regs[op.rd] = op.PC + 4;
+    return target;
+}
+
+static uint64_t opNop(Context& ctx, const Op& op) {
+    (void)ctx;
+    return op.PC + 4;
+}
+
+static uint64_t opHalt(Context& ctx, const Op& op) {
+    ctx.status = HALT;
+    ctx.stop = true;
+    return op.PC;
+}
+
+static uint64_t opIllegal(Context& ctx, const Op& op) {
+    ctx.status = ERROR;
+    ctx.stop = true;
+    return op.PC;
+}
+
+// Pick the specialized handler for a decoded, legal instruction
+static Translator::Handler selectHandler(const Simulator::Instruction& inst) {
+    bool arith = (inst.funct7 >> 1) == UPPERIMM_ARITH;
+    switch (inst.opcode) {
+        case OP_INT:
+            switch (inst.funct3) {
+                case FUNCT3_ADD:  return inst.funct7 == FUNCT7_SUB ? opSub : opAdd;
+                case FUNCT3_SLL:  return opSll;
+                case FUNCT3_SLT:  return opSlt;
+                case FUNCT3_SLTU: return opSltu;
+                case FUNCT3_XOR:  return opXor;
+                case FUNCT3_SR:   return arith ? opSra : opSrl;
+                case FUNCT3_OR:   return opOr;
+                case FUNCT3_AND:  return opAnd;
+            }
+            break;
+        case OP_INTW:
+            switch (inst.funct3) {
+                case FUNCT3_ADD: return inst.funct7 == FUNCT7_SUB ? opSubw : opAddw;
+                case FUNCT3_SLL: return opSllw;
+                case FUNCT3_SR:  return arith ? opSraw : opSrlw;
+            }
+            break;
+        case OP_INTIMM:
+            switch (inst.funct3) {
+                case FUNCT3_ADD:  return opAddi;
+                case FUNCT3_SLL:  return opSlli;
+                case FUNCT3_SLT:  return opSlti;
+                case FUNCT3_SLTU: return opSltiu;
+                case FUNCT3_XOR:  return opXori;
+                case FUNCT3_SR:   return arith ? opSrai : opSrli;
+                case FUNCT3_OR:   return opOri;
+                case FUNCT3_AND:  return opAndi;
+            }
+            break;
+        case OP_INTIMMW:
+            switch (inst.funct3) {
+                case FUNCT3_ADD: return opAddiw;
+                case FUNCT3_SLL: return opSlliw;
+                case FUNCT3_SR:  return arith ? opSraiw : opSrliw;
+            }
+            break;
+        case OP_LOAD:
+            switch (inst.funct3) {
+                case FUNCT3_B:  return opLb;
+                case FUNCT3_H:  return opLh;
+                case FUNCT3_W:  return opLw;
+                case FUNCT3_D:  return opLd;
+                case FUNCT3_BU: return opLbu;
+                case FUNCT3_HU: return opLhu;
+                case FUNCT3_WU: return opLwu;
+            }
+            break;
+        case OP_STORE:
+            switch (inst.funct3) {
+                case FUNCT3_B: return opSb;
+                case FUNCT3_H: return opSh;
+                case FUNCT3_W: return opSw;
+                case FUNCT3_D: return opSd;
+            }
+            break;
+        case OP_BRANCH:
+            switch (inst.funct3) {
+                case FUNCT3_BEQ:  return opBeq;
+                case FUNCT3_BNE:  return opBne;
+                case FUNCT3_BLT:  return opBlt;
+                case FUNCT3_BGE:  return opBge;
+                case FUNCT3_BLTU: return opBltu;
+                case FUNCT3_BGEU: return opBgeu;
+            }
+            break;
+        case OP_LUI:   return opLui;
+        case OP_AUIPC: return opAuipc;
+        case OP_JAL:   return opJal;
+        case OP_JALR:  return opJalr;
+    }
+    return opIllegal;
+}
+
+Translator::Translator(Simulator* sim) : simulator(sim) {
+    ctx.memory = sim->getMemory();
+    ctx.stop = false;
+    ctx.status = SUCCESS;
+}
+
+Translator::~Translator() {
+    ctx.memory->setWriteWatch(0, 0, nullptr, nullptr);
+}
+
+// Memory write watch callback: note the written range and end the current
+// block if it overlaps translated code
+void Translator::onCodeWrite(void* owner, uint64_t address, uint64_t size) {
+    Translator* translator = static_cast<Translator*>(owner);
+    uint64_t last = (address + size - 1) >> 2;
+    for (uint64_t index = address >> 2; index <= last && index < translator->codeWords.size();
+         index++) {
+        if (translator->codeWords[index]) {
+            translator->codeModified = true;
+            translator->modifiedStart = std::min(translator->modifiedStart, address);
+            translator->modifiedEnd = std::max(translator->modifiedEnd, address + size);
+            translator->ctx.stop = true;
+            return;
+        }
+    }
+}
+
+// Translate the basic block starting at PC. A block ends after a branch,
+// jump, halt or illegal instruction, or after MAX_BLOCK_OPS instructions.
+Translator::Block* Translator::translate(uint64_t PC) {
+    Block& block = blocks[PC];
+    block.ops.clear();
+
+    uint64_t curPC = PC;
+    // End of the words fetched from memory, a fetch outside of it is decoded
+    // from a zero word, which is illegal, and ends the block
+    uint64_t fetchedEnd = PC;
+    while (block.ops.size() < MAX_BLOCK_OPS) {
+        Simulator::Instruction inst;
+        inst.PC = curPC;
+        uint64_t word = 0;
+        if (ctx.memory->getMemValue(curPC, word, WORD_SIZE) == 0) {
+            fetchedEnd = curPC + 4;
+        }
+        inst.instruction = (uint32_t)word;
+        simulator->simDecode(inst);
+
+        Op op;
+        op.PC = curPC;
+        op.imm = inst.imm;
+        op.rd = inst.rd == 0 ? REG_SINK : inst.rd;
+        op.rs1 = inst.rs1;
+        op.rs2 = inst.rs2;
+
+        bool endsBlock = true;
+        if (inst.isHalt) {
+            op.handler = opHalt;
+        } else if (!inst.isLegal) {
+            op.handler = opIllegal;
+        } else if (inst.isNop) {
+            op.handler = opNop;
+            endsBlock = false;
+        } else {
+            op.handler = selectHandler(inst);
+            endsBlock = inst.opcode == OP_BRANCH || inst.opcode == OP_JAL || inst.opcode == OP_JALR;
+        }
+        block.ops.push_back(op);
+
+        curPC += 4;
+        if (endsBlock) break;
+    }
+    block.start = PC;
+    block.end = fetchedEnd;
+
+    // Mark the block's words in memory and widen the watched range to cover
+    // them; nothing can write the words outside of memory
+    if (fetchedEnd == PC) {
+        return &block;
+    }
+    if ((fetchedEnd >> 2) > codeWords.size()) {
+        codeWords.resize(fetchedEnd >> 2, false);
+    }
+    for (uint64_t index = PC >> 2; index < (fetchedEnd >> 2); index++) {
+        codeWords[index] = true;
+    }
+    codeStart = std::min(codeStart, PC);
+    codeEnd = std::max(codeEnd, fetchedEnd);
+    ctx.memory->setWriteWatch(codeStart, codeEnd, onCodeWrite, this);
+    return &block;
+}
+
+Translator::Block* Translator::lookup(uint64_t PC) {
+    auto found = blocks.find(PC);
+    return found != blocks.end() ? &found->second : translate(PC);
+}
+
+// Find the successor of block at PC, through its links when possible
+Translator::Block* Translator::follow(Block* block, uint64_t PC) {
+    for (Link& link : block->links) {
+        if (link.block && link.nextPC == PC) {
+            return link.block;
+        }
+    }
+    Block* next = lookup(PC);
+    Link& link = block->links[block->nextLink];
+    block->nextLink ^= 1;
+    link.nextPC = PC;
+    link.block = next;
+    return next;
+}
+
+void Translator::unlinkAll() {
+    for (auto& entry : blocks) {
+        for (Link& link : entry.second.links) {
+            link = Link();
+        }
+    }
+}
+
+// Drop the blocks overlapping the code written since the last call. Links
+// may point at dropped blocks, so they are all cut and rebuilt lazily.
+void Translator::invalidateModified() {
+    for (auto it = blocks.begin(); it != blocks.end();) {
+        if (it->second.start < modifiedEnd && it->second.end > modifiedStart) {
+            for (uint64_t index = it->second.start >> 2; index < (it->second.end >> 2); index++) {
+                codeWords[index] = false;
+            }
+            it = blocks.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    // Overlapping blocks may share words with dropped ones
+    for (auto& entry : blocks) {
+        for (uint64_t index = entry.second.start >> 2; index < (entry.second.end >> 2); index++) {
+            codeWords[index] = true;
+        }
+    }
+    unlinkAll();
+
+    codeModified = false;
+    modifiedStart = UINT64_MAX;
+    modifiedEnd = 0;
+}
+
+// Drop every translated block
+void Translator::flush() {
+    blocks.clear();
+    codeWords.clear();
+    codeStart = UINT64_MAX;
+    codeEnd = 0;
+    codeModified = false;
+    modifiedStart = UINT64_MAX;
+    modifiedEnd = 0;
+    ctx.memory->setWriteWatch(0, 0, nullptr, nullptr);
+}
+
+Status Translator::run(uint64_t& PC, uint64_t maxInstructions) {
+    for (int i = 0; i < NUM_REGS; i++) {
+        ctx.regs[i] = simulator->regData.registers[i];
+    }
+    ctx.regs[0] = 0;
+    ctx.status = SUCCESS;
+    ctx.stop = false;
+
+    // Code may have been written while we were not running
+    if (codeModified) {
+        invalidateModified();
+    }
+
+    uint64_t executed = 0;
+    Block* block = lookup(PC);
+    while (true) {
+        size_t count = block->ops.size();
+        if (maxInstructions != 0 && count > maxInstructions - executed) {
+            count = maxInstructions - executed;
+        }
+
+        size_t i = 0;
+        while (i < count) {
+            const Op& op = block->ops[i++];
+            PC = op.handler(ctx, op);
+            if (ctx.stop) break;
+        }
+        executed += i;
+
+        if (ctx.stop) {
+            ctx.stop = false;
+            if (ctx.status != SUCCESS) break;
+            if (codeModified) {
+                invalidateModified();
+                block = nullptr;
+            }
+        }
+        if (maxInstructions != 0 && executed >= maxInstructions) break;
+
+        block = block ? follow(block, PC) : lookup(PC);
+    }
+
+    for (int i = 1; i < NUM_REGS; i++) {
+        simulator->regData.registers[i] = ctx.regs[i];
+    }
+    simulator->din += executed;
+    // Stores above bypassed simMemAccess, so nothing the interpreter decoded
+    // earlier can be trusted any more
+    simulator->clearDecoded();
+    return ctx.status;
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <inttypes.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "MemoryStore.h"
+#include "Utilities.h"
+#include "simulator.h"
+
+// Longest run of instructions translated into one block
+#define MAX_BLOCK_OPS 64
+
+// Alternate execution engine for the functional simulator. Basic blocks are
+// translated once into arrays of operations, each bound to a handler that is
+// specialized for its opcode/funct3/funct7, and then run by calling the
+// handlers directly instead of going through the simInstruction() chain.
+// Translated blocks are cached and chained to their successors, and a block
+// is retranslated when any setMemValue() writes into its code.
+class Translator {
+   public:
+    struct Context;
+    struct Op;
+
+    // Executes one operation and returns the PC of the next one
+    typedef uint64_t (*Handler)(Context& ctx, const Op& op);
+
+    struct Op {
+        Handler handler;
+        uint64_t PC;
+        uint64_t imm;
+        uint8_t rd;   // REG_SINK when the instruction writes x0
+        uint8_t rs1;
+        uint8_t rs2;
+    };
+
+    // Writes to x0 land in this extra slot so that x0 always reads 0
+    static const uint8_t REG_SINK = NUM_REGS;
+
+    struct Context {
+        uint64_t regs[NUM_REGS + 1];
+        MemoryStore* memory;
+        bool stop;           // set by handlers that end the current block early
+        Status status;
+    };
+
+   private:
+    struct Block;
+
+    // Direct link to a successor block, valid while nextPC matches
+    struct Link {
+        uint64_t nextPC = 0;
+        Block* block = nullptr;
+    };
+
+    struct Block {
+        uint64_t start = 0;   // block covers the words [start, end) of memory
+        uint64_t end = 0;
+        std::vector<Op> ops;
+        Link links[2];        // taken/not-taken, or recent JALR targets
+        uint8_t nextLink = 0;
+    };
+
+    Simulator* simulator;
+    Context ctx;
+    std::unordered_map<uint64_t, Block> blocks;
+
+    // Translated code lies in [codeStart, codeEnd); codeWords marks the
+    // words of it that belong to some block
+    uint64_t codeStart = UINT64_MAX;
+    uint64_t codeEnd = 0;
+    std::vector<bool> codeWords;
+
+    // Range written by setMemValue() since the last invalidation
+    bool codeModified = false;
+    uint64_t modifiedStart = UINT64_MAX;
+    uint64_t modifiedEnd = 0;
+
+    Block* translate(uint64_t PC);
+    Block* lookup(uint64_t PC);
+    Block* follow(Block* block, uint64_t PC);
+    void invalidateModified();
+    void unlinkAll();
+
+    static void onCodeWrite(void* owner, uint64_t address, uint64_t size);
+
+   public:
+    explicit Translator(Simulator* sim);
+    ~Translator();
+
+    /** Run translated code starting at PC
+     * @return HALT on 0xfeedfeed, ERROR on an illegal instruction and
+     *         SUCCESS once maxInstructions have run (0 means no limit)
+     * @param
+     *      PC: start PC, updated to the next PC to execute
+     *      maxInstructions: instruction budget for this call
+     */
+    Status run(uint64_t& PC, uint64_t maxInstructions);
+
+    // Forget all translations
+    void flush();
+
+    uint64_t getNumBlocks() const { return blocks.size(); }
+};
@@ -0,0 +1,35 @@
+_start:
+	# Five blocks in one D-cache set, which holds four, so every pass
+	# misses on all of them. blocks[0] and blocks[1] also share an L2
+	# line: a non-inclusive L2 keeps only the one filled last, an
+	# exclusive L2 takes both back as victims and hands them up again,
+	# and an inclusive L2 evicts them from the D-cache as well
+	li   s0, 0x2200     # s0 = &blocks[0]
+	li   t1, 3          # t1 = passes
+pass:
+	lw   t3, 0(s0)      # blocks[0], the L2 line of blocks[1]
+	lw   t4, 1024(s0)   # blocks[1]
+	lw   t5, 64(s0)     # blocks[2], dirty from here on
+	add  t5, t5, t3
+	add  t5, t5, t4
+	sw   t5, 64(s0)
+	lw   t6, 128(s0)    # blocks[3]
+	lw   t3, 192(s0)    # blocks[4]
+	addi t1, t1, -1
+	bgtz t1, pass
+
+	# Two dirty blocks 1 KB apart share an L2 line but both fit in the
+	# D-cache: an inclusive L2 evicts each one from the D-cache as it
+	# fills the other, and writes it back
+	li   s1, 0x2380     # s1 = &pair[0], pair[1] is 1 KB above
+	sw   s1, 0(s1)      # pair[0] = &pair[0]
+	li   t1, 4          # t1 = rounds
+pair:
+	lw   t3, 0(s1)      # t3 = pair[0]
+	lw   t4, 1024(s1)   # t4 = pair[1]
+	add  t4, t4, t3
+	sw   t4, 1024(s1)   # pair[1] += pair[0]
+	addi t1, t1, -1
+	bgtz t1, pair
+
+.word 0xfeedfeed